@@ -0,0 +1,11 @@
+# Writes the content of INPUT to OUTPUT as a C array called NAME, and its
+# size as NAME_size. Run with cmake -DINPUT=... -DOUTPUT=... -DNAME=... -P
+file(READ ${INPUT} _hex HEX)
+string(LENGTH "${_hex}" _len)
+math(EXPR _size "${_len} / 2")
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," _bytes "${_hex}")
+file(WRITE ${OUTPUT}
+    "// generated from ${INPUT}, do not edit\n"
+    "static const unsigned char ${NAME}[] = {${_bytes}};\n"
+    "static const size_t ${NAME}_size = ${_size};\n"
+)
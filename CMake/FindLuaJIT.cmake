@@ -0,0 +1,34 @@
+# - Try to find LuaJIT
+# Once done this will define
+#
+#  LUAJIT_FOUND - system has LuaJIT
+#  LUAJIT_INCLUDE_DIRS - the LuaJIT include directory
+#  LUAJIT_LIBRARIES - Link these to use LuaJIT
+#
+
+find_package(PkgConfig)
+
+if(LuaJIT_FIND_REQUIRED)
+	set(_pkgconfig_REQUIRED "REQUIRED")
+else(LuaJIT_FIND_REQUIRED)
+	set(_pkgconfig_REQUIRED "")
+endif(LuaJIT_FIND_REQUIRED)
+
+pkg_check_modules(LUAJIT ${_pkgconfig_REQUIRED} luajit>=2.1)
+
+if(NOT LUAJIT_FOUND AND NOT PKG_CONFIG_FOUND)
+	find_path(LUAJIT_INCLUDE_DIRS luajit.h PATH_SUFFIXES luajit-2.1)
+	find_library(LUAJIT_LIBRARIES luajit-5.1)
+else(NOT LUAJIT_FOUND AND NOT PKG_CONFIG_FOUND)
+	set(LUAJIT_LIBS_ABSOLUTE)
+	foreach(lib ${LUAJIT_LIBRARIES})
+		set(var_name LUAJIT_${lib}_ABS)
+		find_library(${var_name} ${lib} ${LUAJIT_LIBRARY_DIRS})
+		list(APPEND LUAJIT_LIBS_ABSOLUTE ${${var_name}})
+	endforeach()
+	set(LUAJIT_LIBRARIES ${LUAJIT_LIBS_ABSOLUTE})
+endif(NOT LUAJIT_FOUND AND NOT PKG_CONFIG_FOUND)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LUAJIT DEFAULT_MSG LUAJIT_LIBRARIES LUAJIT_INCLUDE_DIRS)
+mark_as_advanced(LUAJIT_LIBRARIES LUAJIT_INCLUDE_DIRS)
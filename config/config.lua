@@ -25,6 +25,23 @@ config = {
     view_border_size                    = 2,
     view_border_active_color            = 0x4897cfff,
     view_border_inactive_color          = 0x475b74ff,
+    view_update_interval                = 100,  -- ms, limits title updates
+
+    -- limits of lua callbacks per run, 0 means unlimited. callbacks that
+    -- overrun are disabled for 'budget_cooldown' seconds.
+    budgets = {
+        widget      = {instructions = 10000000, ms = 500},
+        keybinding  = {instructions = 5000000, ms = 100},
+    },
+    budget_cooldown                     = 30,
+
+    -- s between profiler reports in the log when wavy runs with -p or
+    -- profiler(true) was called, profiler_report() returns the report
+    profiler_interval                   = 60,
+
+    -- KiB per lua state, above this lua collects garbage before it grows.
+    -- lua_memory() returns the usage of the config, widgets and keybindings.
+    lua_memory_limit                    = 32768,
 
     wallpaper                           = "./assets/Penguin2_1080.png"
 }
@@ -55,6 +72,9 @@ bar = {
     separator       = true,                     -- might look bad with gaps
     separator_color = 0x2d95efff,
     separator_width = 1,                        -- pixels
+    workers         = 2,                        -- threads running widgets
+    glyph_atlas     = false,                    -- fast ASCII text, monospace
+    host            = false,                    -- run widgets in wavy-barhost
 
     colors = {
         background              = 0x282828a0,
@@ -64,7 +84,17 @@ bar = {
         inactive_workspace_font = 0xccccccff,
     },
 
-    -- see "wavy_utils.lua" for the implementation of the default widgets
+    -- see "wavy_utils.lua" for the implementation of the default widgets.
+    -- a widget is {alignment, hook, callback}, periodic widgets accept the
+    -- optional fields 'interval' (seconds) and 'align' (fire on wall clock
+    -- multiples of the interval). 'watch' runs a widget when a kernel
+    -- event source fires instead of polling it, 'events' on compositor
+    -- events (see wavy.on_event). 'scope = "output"' runs a widget
+    -- separately for every output. 'budget = {instructions, ms}' overrides
+    -- the default limits of the callback. with 'host = true' global widgets
+    -- run in wavy-barhost, which has no get_layout, get_view_title,
+    -- get_tiling_symbol or layout_* functions, only per-output widgets can
+    -- use them then.
     widgets = {
         wavy.widgets.default.time,
         wavy.widgets.default.battery,
@@ -79,10 +109,11 @@ bar = {
         },
         {
             wavy.alignment.right,
-            wavy.hooks.periodic_slow,
+            wavy.hooks.event,
             function()
                 return wavy.widgets.callbacks.net_device("wlp4s0")
-            end
+            end,
+            watch = "net"
         },
         {
             wavy.alignment.right,
@@ -123,6 +154,7 @@ keys = {
 
     -- window managing basics
     {"exit",              {modkey, "shift"}, "e"},
+    {"reload",            {modkey, "shift"}, "r"},  -- reload this file
     {"close_view",        {modkey},          "q"},
     {"cycle_tiling_mode", {modkey},          "space"},
 
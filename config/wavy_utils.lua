@@ -9,7 +9,23 @@ wavy.widgets.callbacks = {}     -- statusbar callback functions
 local bg = 0x404055e8           -- default background (RGBA)
 local fg = 0xffffffff           -- default foreground (RGBA)
 
+-- widgets using 'periodic' need an 'interval' field (seconds), the fast/slow
+-- hooks default to 1s and 30s. set 'align = true' to fire on wall clock
+-- multiples of the interval.
+-- widgets using 'event' only run when one of their sources in 'watch'
+-- fires: "net", "power_supply", "backlight" or the absolute path of a file.
+-- 'watch' can be added to widgets with any other hook as well.
+-- 'events' runs a widget on compositor events instead (a name or a list of
+-- names, see wavy.on_event), at most once per iteration of the event loop.
+-- periodic widgets can have a 'next' function, which is called with the
+-- time of the next tick (seconds since the epoch) and returns the content
+-- the widget will have then.
+-- set 'scope = "output"' for widgets that show something different on every
+-- output. their callback receives the output as an argument, and layout
+-- changes only rerun them for the output that changed.
 wavy.hooks = {
+    event = "hook_event",
+    periodic = "hook_periodic",
     periodic_slow = "hook_periodic_slow",
     periodic_fast = "hook_periodic_fast",
     view_update = "hook_view_update",
@@ -21,13 +37,46 @@ wavy.alignment = {
     left = "left"
 }
 
+-- run a shell command and return its whole output. inside widget callbacks
+-- and keybindings, the caller is suspended until the command is done instead
+-- of blocking, so several commands can run at the same time.
+wavy.spawn_read = spawn_read
+
+-- layout operations for lua keybindings. wavy.batch(f) runs f and redraws
+-- the layout once when it returns, instead of after every operation, e.g.
+--   wavy.batch(function()
+--       wavy.layout.frame_add("right")
+--       wavy.layout.move_to_workspace(2)
+--   end)
+wavy.batch = layout_batch
+wavy.layout = {
+    frame_add = layout_frame_add,                   -- "right" or "down"
+    frame_delete = layout_frame_delete,
+    focus = layout_focus,                           -- direction or view
+    move = layout_move,                             -- direction
+    resize = layout_resize,                         -- direction, percent
+    move_to_workspace = layout_move_to_workspace,   -- number
+    select_workspace = layout_select_workspace,     -- number
+    cycle_tiling_mode = layout_cycle_tiling_mode,
+}
+
+-- compositor events: "view_created", "view_destroyed", "focus_changed",
+-- "workspace_switched", "output_added" and "title_changed".
+-- wavy.on_event(names, f) calls f with the list of events of one iteration
+-- of the event loop, e.g.
+--   wavy.on_event({"view_created", "title_changed"}, function(events)
+--       for _, e in ipairs(events) do
+--           print(e.type, e.view, e.output, e.title, e.app_id)
+--       end
+--   end)
+-- workspace_switched events have 'workspace' (starting at 1) and 'output'.
+-- focus_changed events have no 'view' when an empty frame became active.
+-- f runs like a lua keybinding, it can use wavy.spawn_read and the layout
+-- operations.
+wavy.on_event = on_event
+
 function wavy.utils.exec(cmd)   -- execute a shell command and return its result
-    local r = io.popen(cmd)
-    if not r then
-        return ""
-    end
-    local s = r:read()
-    r:close()
+    local s = wavy.spawn_read(cmd):match("[^\n]*")
     if s then
         return s
     else
@@ -35,6 +84,13 @@ function wavy.utils.exec(cmd)   -- execute a shell command and return its result
     end
 end
 
+-- cheap reads of small kernel files (sysfs, procfs), no process is spawned.
+-- they return nil if the file doesn't exist.
+wavy.utils.read_file = sys_read_file    -- content as a string
+wavy.utils.read_int = sys_read_int      -- content as an integer
+wavy.utils.statvfs = sys_statvfs        -- {size, free, avail, used_percent}
+wavy.utils.meminfo = sys_meminfo        -- value of a /proc/meminfo key in kB
+
 -- pulseaudio control using 'pamixer'.
 function wavy.utils.pulsectl(action, change)
     if action == "up" then
@@ -47,10 +103,7 @@ function wavy.utils.pulsectl(action, change)
         return
     end
 
-    local r = io.popen(cmd)
-    if r then
-        r:close()
-    end
+    wavy.spawn_read(cmd)
     trigger_hook(wavy.hooks.user)
 end
 
@@ -72,29 +125,32 @@ function wavy.utils.brtctl(action)
         return
     end
 
-    local r = io.popen(cmd)
-    if r then
-        r:close()
-    end
+    wavy.spawn_read(cmd)
     trigger_hook(wavy.hooks.user)
 end
 
--- current time. set 'man strftime' for formatting options.
-function wavy.widgets.callbacks.time()
-    return {bg, fg, os.date("%a %b %d %Y %H:%M")}
+-- current time, or the time 't' (seconds since the epoch). set 'man
+-- strftime' for formatting options.
+function wavy.widgets.callbacks.time(t)
+    return {bg, fg, os.date("%a %b %d %Y %H:%M", t)}
 end
 
 -- kernel version.
 function wavy.widgets.callbacks.kernel()
-    local s = "Linux: " .. wavy.utils.exec("uname -r")
-    return {bg, fg, s}
+    return {bg, fg, native_kernel() or ""}
 end
 
--- display backlight brightness. depends on 'light'.
-function wavy.widgets.callbacks.brightness()
-    local cmd = [[ light -G | xargs printf "%.0f\n" ]]
-    local str = "Screen: " .. wavy.utils.exec(cmd) .. "%"
-    return {bg, fg, str}
+-- display backlight brightness, read from /sys/class/backlight. the device
+-- defaults to the first one found.
+local backlight = nil
+function wavy.widgets.callbacks.brightness(dev)
+    backlight = dev or backlight or native_backlight_device()
+    local str = backlight and native_brightness(backlight)
+    if str then
+        return {bg, fg, str}
+    else
+        return {0, 0, ""}
+    end
 end
 
 -- audio volume. depends on pulseaudio and pamixer.
@@ -111,18 +167,10 @@ end
 
 -- arg: battery := BAT0, BAT1, etc.
 function wavy.widgets.callbacks.battery(battery)
-    local f_cap = io.open("/sys/class/power_supply/" .. battery .. "/capacity", "r")
-    if f_cap then
-        local bat_cap = f_cap:read()
-        f_cap:close()
-        local str = battery .. ": " .. bat_cap .. "%"
+    local str = native_battery(battery)
+    if str then
         return {bg, fg, str}
     else
-        if f_cap then
-            f_cap:close()
-        elseif f_stat then
-            f_stat:close()
-        end
         return {0, 0, ""}
     end
 end
@@ -130,26 +178,34 @@ end
 -- file system usage.
 -- must be wrapped in a lambda function that takes no arguments.
 function wavy.widgets.callbacks.fs_status(directory)
-    cmd = [[ df --output=pcent -h ]] .. directory .. [[ | tail -n1 ]]
-    local fs_used = wavy.utils.exec(cmd)
-    local str = "Disk: " .. directory .. fs_used .. " used"
-    return {bg, fg, str}
+    local str = native_fs_status(directory)
+    if str then
+        return {bg, fg, str}
+    else
+        return {0, 0, ""}
+    end
 end
 
 -- ip of network device.
 -- must be wrapped in a lambda function that takes no arguments.
 function wavy.widgets.callbacks.net_device(dev)
-    local cmd = [[ ip addr show dev ]] .. dev
-                .. [[| grep -o -m1 inet\ [0-9\.]* ]]
-                .. [[ | cut -d ' ' -f 2 ]]
-    local ip_str = wavy.utils.exec(cmd)
+    local str = native_net_device(dev)
+    if str then
+        return {bg, fg, str}
+    else
+        return {0, 0, ""}
+    end
+end
 
-    if ip_str == "" then
+-- memory usage.
+function wavy.widgets.callbacks.memory()
+    local total = wavy.utils.meminfo("MemTotal")
+    local avail = wavy.utils.meminfo("MemAvailable")
+    if not total or not avail or total == 0 then
         return {0, 0, ""}
-    else
-        str = dev .. ": " .. ip_str
-        return {bg, fg, str}
     end
+    local used = math.floor((total - avail) * 100 / total + 0.5)
+    return {bg, fg, "Mem: " .. used .. "%"}
 end
 
 -- wifi status.
@@ -169,20 +225,29 @@ function wavy.widgets.callbacks.wifi(dev)
     end
 end
 
--- calls the C library
-function wavy.widgets.callbacks.view_title()
-    return {bg, fg, get_view_title()}
+-- calls the C library. 'out' is passed to per-output widgets. both read the
+-- layout snapshot, get_layout() returns all of it (outputs, workspaces,
+-- frames and views, e.g. get_layout().view.title)
+function wavy.widgets.callbacks.view_title(out)
+    return {bg, fg, get_view_title(out)}
 end
 
--- calls the C library
-function wavy.widgets.callbacks.tiling_symbol()
-    return {bg, fg, get_tiling_symbol()}
+-- calls the C library. 'out' is passed to per-output widgets.
+function wavy.widgets.callbacks.tiling_symbol(out)
+    return {bg, fg, get_tiling_symbol(out)}
 end
 
+-- updates exactly on the minute. the next minute is drawn ahead of time and
+-- swapped in when the tick fires.
 wavy.widgets.default.time = {
     wavy.alignment.right,
-    wavy.hooks.periodic_slow,
-    wavy.widgets.callbacks.time
+    wavy.hooks.periodic,
+    function()
+        return wavy.widgets.callbacks.time()
+    end,
+    interval = 60,
+    align = true,
+    next = wavy.widgets.callbacks.time
 }
 
 wavy.widgets.default.kernel = {
@@ -191,10 +256,21 @@ wavy.widgets.default.kernel = {
     wavy.widgets.callbacks.kernel
 }
 
+-- not every battery reports capacity changes, so keep polling as well
+wavy.widgets.default.battery = {
+    wavy.alignment.right,
+    wavy.hooks.periodic_slow,
+    function()
+        return wavy.widgets.callbacks.battery("BAT0")
+    end,
+    watch = "power_supply"
+}
+
 wavy.widgets.default.brightness = {
     wavy.alignment.right,
-    wavy.hooks.user,
-    wavy.widgets.callbacks.brightness
+    wavy.hooks.event,
+    wavy.widgets.callbacks.brightness,
+    watch = "backlight"
 }
 
 wavy.widgets.default.volume = {
@@ -203,16 +279,26 @@ wavy.widgets.default.volume = {
     wavy.widgets.callbacks.volume
 }
 
+wavy.widgets.default.memory = {
+    wavy.alignment.right,
+    wavy.hooks.periodic_fast,
+    wavy.widgets.callbacks.memory
+}
+
 wavy.widgets.default.view_title = {
     wavy.alignment.left,
-    wavy.hooks.view_update,
-    wavy.widgets.callbacks.view_title
+    wavy.hooks.event,
+    wavy.widgets.callbacks.view_title,
+    scope = "output",
+    events = {"focus_changed", "title_changed", "view_destroyed",
+              "workspace_switched", "output_added"}
 }
 
 wavy.widgets.default.tiling_symbol = {
     wavy.alignment.left,
     wavy.hooks.view_update,
-    wavy.widgets.callbacks.tiling_symbol
+    wavy.widgets.callbacks.tiling_symbol,
+    scope = "output"
 }
 
 return wavy
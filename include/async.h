@@ -0,0 +1,48 @@
+#ifndef __ASYNC_H
+#define __ASYNC_H
+#include <stdbool.h>
+
+#include "luacompat.h"
+
+/*
+ * Non-blocking process output for lua coroutines. spawn_read(cmd) runs a
+ * shell command with its stdout connected to a pipe that is watched by the
+ * wlc event loop and yields the calling coroutine until the command closed
+ * its output. Code that runs lua functions in coroutines created with
+ * async_thread_new() registers a resume function for its lua_State, which
+ * is called on the main loop once the output is complete. Everywhere else
+ * spawn_read blocks until the command is done.
+ */
+
+// Called on the main loop when the output of a command that was started in
+// the coroutine co is complete. output is owned by the callee.
+typedef void (*async_resume_t)(void *owner, lua_State *co, char *output);
+
+// Sets the resume function for coroutines of L. Must be called before any
+// coroutine of L yields.
+void async_set_runner(lua_State *L, async_resume_t resume, void *owner);
+
+// Creates a coroutine that runs the function on top of the stack of L (the
+// function is popped). The coroutine stays alive until async_thread_free().
+lua_State *async_thread_new(lua_State *L);
+void async_thread_free(lua_State *L, lua_State *co);
+
+// Whether coroutines of L created with async_thread_new are still alive.
+bool async_threads_pending(lua_State *L);
+
+// Resumes a coroutine with nargs values on its stack. Returns LUA_YIELD while
+// the coroutine waits for a command, LUA_OK if it returned (the results are
+// on the stack of co) or an error code. Errors are logged with a traceback.
+int async_resume(lua_State *co, int nargs);
+
+// lua: spawn_read(cmd) returns the output of the command as a string
+int async_spawn_read(lua_State *L);
+
+// Drops the running commands of coroutines whose runner has this owner, e.g.
+// before their lua_State is closed. They are never resumed. Main loop only.
+void async_drop(void *owner);
+
+// Drops commands that are still running, their coroutines are never resumed.
+void free_async();
+
+#endif
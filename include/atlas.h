@@ -0,0 +1,43 @@
+#ifndef __ATLAS_H
+#define __ATLAS_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <cairo/cairo.h>
+
+/*
+ * Glyph atlas for bar text. The printable ASCII glyphs of a font are
+ * rasterized once into alpha masks, strings are drawn by masking the current
+ * source with the glyphs of their characters. There is no kerning or
+ * shaping, which is fine for monospace fonts. Text containing anything but
+ * printable ASCII has to be drawn with Pango instead.
+ */
+
+#define ATLAS_FIRST_CHAR 32
+#define ATLAS_LAST_CHAR 126
+
+struct glyph_t {
+    cairo_surface_t *mask; // A8 surface of the glyph cell
+    uint32_t advance;
+};
+
+struct glyph_atlas_t {
+    char *font;
+    uint32_t height; // line height of the font
+    struct glyph_t glyphs[ATLAS_LAST_CHAR - ATLAS_FIRST_CHAR + 1];
+};
+
+// Rasterizes the glyphs of a font (Pango font description string). Returns
+// NULL on failure.
+struct glyph_atlas_t *atlas_create(const char *font);
+void atlas_free(struct glyph_atlas_t *atlas);
+
+// Calculates the size of a string. Returns false if the atlas can't draw it.
+bool atlas_measure(struct glyph_atlas_t *atlas, const char *text,
+        uint32_t *width, uint32_t *height);
+
+// Draws a string with its top left corner at x, y using the current source
+// of cr. The string must have been accepted by atlas_measure.
+void atlas_draw(struct glyph_atlas_t *atlas, cairo_t *cr, const char *text,
+        double x, double y);
+
+#endif
@@ -6,17 +6,18 @@
 #include <wlc/wlc.h>
 #include <pthread.h>
 #include <time.h>
-#include <lua.h>
-#include <lualib.h>
-#include <lauxlib.h>
 
+#include "luacompat.h"
 #include "layout.h"
+#include "budget.h"
 
 enum hook_t {
     HOOK_PERIODIC_SLOW,
     HOOK_PERIODIC_FAST,
+    HOOK_PERIODIC,
     HOOK_VIEW_UPDATE,
     HOOK_USER,
+    HOOK_EVENT,
     HOOK_UNKNOWN
 };
 
@@ -26,6 +27,32 @@ enum side_t {
     SIDE_UNKNOWN
 };
 
+// global widgets show the same content on every bar. per-output widgets
+// (e.g. the title of the focused view) are run once for every output and
+// their callback receives the output as an argument.
+enum scope_t {
+    SCOPE_GLOBAL,
+    SCOPE_OUTPUT
+};
+
+// content of a per-output widget on one output
+struct widget_slot_t {
+    wlc_handle output;
+    char *entry;
+    uint32_t bg_color;
+    uint32_t fg_color;
+    bool dirty; // needs a run for this output
+};
+
+// rasterized background and text of a global widget. it is drawn once per
+// content change and composited into the bar of every output.
+struct widget_strip_t {
+    cairo_surface_t *surface;
+    uint32_t width;
+    uint32_t height;
+    uint64_t gen;  // content generation the strip was drawn for
+};
+
 struct status_entry_t {
     enum hook_t hook;
     enum side_t side;
@@ -33,6 +60,70 @@ struct status_entry_t {
     uint32_t bg_color;
     uint32_t fg_color;
     uint32_t lua_reg_idx; // idx of a function registerd at LUA_REGISTRYINDEX
+    uint32_t config_idx;  // position in the 'widgets' table of the config
+
+    // per-output widgets keep their content in slots (*widget_slot_t's)
+    // instead of the fields above. protected by the widget lock in bar.c.
+    enum scope_t scope;
+    struct vector_t *slots;
+
+    // bumped whenever the global content changes (widget lock) and the
+    // cached strip of it (render thread only)
+    uint64_t content_gen;
+    struct widget_strip_t strip;
+
+    // periodic global widgets can have a 'next' function that returns their
+    // content for the next tick. it is staged here (widget lock) and drawn
+    // ahead of time, then committed when the tick fires.
+    bool precompute;
+    int32_t worker_next_ref;
+    bool has_next;
+    char *next_entry;
+    uint32_t next_bg_color;
+    uint32_t next_fg_color;
+    uint64_t next_gen;
+    struct widget_strip_t next_strip;
+
+    // the worker thread the widget is pinned to and the reference to the
+    // callback function in that worker's lua_State
+    uint32_t worker;
+    int32_t worker_ref;
+    struct budget_t budget; // worker thread only
+
+    // periodic widgets only. if 'align' is set, the widget fires on wall
+    // clock multiples of the interval (e.g. exactly on the minute).
+    uint32_t interval_ms;
+    bool align;
+    int64_t next_ms; // next deadline on the monotonic clock (scheduler only)
+
+    // event sources the widget watches (see sources.h): a mask of
+    // enum source_t and the paths of watched files (char*'s)
+    uint32_t watch;
+    struct vector_t *watch_files;
+
+    // compositor events that queue the widget, a mask of enum event_t (see
+    // events.h)
+    uint32_t events;
+
+    bool queued; // waiting for its worker thread
+
+    // global widgets that run in the bar host process (see barhost.h): the
+    // slot in the shared buffer (-1 if none) and the strip the host drew
+    // for them, which takes precedence over the content fields above
+    // (widget lock)
+    int32_t host_slot;
+    struct widget_strip_t host_strip;
+
+    // hash of the callback's code (see bytecode_hash), a reload restarts
+    // the widgets if it changed
+    uint64_t code_hash;
+
+    // coroutine of a callback that waits for a command (see async.h) and
+    // whether the widget was queued again in the meantime. only used by the
+    // worker thread.
+    lua_State *co;
+    bool rerun;
+    wlc_handle run_output; // output of the current run, 0 if global
 };
 
 extern struct wavy_config_t *config;
@@ -41,18 +132,93 @@ extern pthread_mutex_t lua_lock;
 
 static struct vector_t *status_entries;
 
-// threads that periodically trigger the fast/slow hooks
-static pthread_t hook_thread_fast;
-static pthread_t hook_thread_slow;
+// interval_ms is only used for periodic hooks, 0 selects the default.
+struct status_entry_t *widget_new(enum side_t side, enum hook_t hook,
+        int lua_ref, uint32_t config_idx, uint32_t interval_ms, bool align);
+void widget_free(void *e);
+
+// true if two widgets were configured the same way and run the same code
+bool widget_equal(struct status_entry_t *a, struct status_entry_t *b);
+
+// replaces the list of widgets (*status_entry_t's) and frees the old one.
+// the workers, scheduler, sources and bar host must be stopped. main loop
+// only.
+void bar_replace_widgets(struct vector_t *widgets);
+
+// keeps the render thread from drawing while the config is replaced, waits
+// until the bar it draws right now is done. main loop only.
+void bar_pause_render();
+
+// lets the render thread go on. if restyle is set (e.g. the font changed),
+// the cached strips and the glyph atlas are dropped.
+void bar_resume_render(bool restyle);
+
+// returns the list of widgets (*status_entry_t's)
+struct vector_t *get_widgets();
+
+// stores the result of a widget callback for an output (0 for global
+// widgets). returns true if the text or one of the colors differs from what
+// is currently displayed.
+bool set_widget_content(struct status_entry_t *e, wlc_handle output,
+        const char *text, uint32_t fg_color, uint32_t bg_color);
+
+// stores the content a widget will have on its next tick and queues drawing
+// the staged frames. can be called from any thread.
+void stage_widget_content(struct status_entry_t *e, const char *text,
+        uint32_t fg_color, uint32_t bg_color);
 
-void add_widget(enum side_t side, enum hook_t hook, int lua_ref);
+// makes the staged content of the widgets current. bars whose staged frame
+// is still up to date get it swapped in right away, the others are redrawn.
+// called by the scheduler when the widgets' tick fires.
+void bar_commit_staged(struct status_entry_t **entries, uint32_t count);
 
-// triggers the specified hook and updates all data associated with it by
-// calling the lua callback function.
+// marks the slot of a per-output widget for an output (0 for all outputs) as
+// needing a run
+void widget_mark_dirty(struct status_entry_t *e, wlc_handle output);
+
+// takes the next output a per-output widget needs to run for. returns false
+// if there is none.
+bool widget_take_dirty(struct status_entry_t *e, wlc_handle *output);
+
+// replaces the strip the bar host drew for a global widget, takes ownership
+// of surface. NULL drops it. can be called from any thread.
+void set_widget_host_strip(struct status_entry_t *e, cairo_surface_t *surface,
+        uint32_t width, uint32_t height);
+
+// queues a repaint of every bar, used when the content of a widget changed.
+// can be called from any thread.
+void bar_request_repaint_all();
+
+// queues a repaint of the bar of a single output. can be called from any
+// thread.
+void bar_request_repaint_output(wlc_handle output);
+
+// queues all widgets associated with the specified hook. the bars are only
+// repainted if at least one widget returned a different text or color.
 void trigger_hook(enum hook_t hook);
 
-// updates the buffer with the available data
-void update_bar(struct output *out);
+// like trigger_hook, but per-output widgets only run for one output
+void trigger_hook_output(enum hook_t hook, wlc_handle output);
+
+// marks a hook as pending instead of running it right away. pending hooks
+// are run once by hook_flush on the next output render, no matter how often
+// they were requested until then. per-output widgets only run for 'output',
+// unless the hook was requested for different outputs (0 means all outputs).
+// must be called from the main loop.
+void hook_request(enum hook_t hook, wlc_handle output);
+
+// runs the pending hooks. called from a wlc render callback.
+void hook_flush();
+
+// number of times a hook was requested with hook_request and how often it
+// actually ran
+void hook_stats(enum hook_t hook, uint64_t *requested, uint64_t *executed);
+
+// copies the layout state of an output and queues a repaint of its bar. the
+// bar is drawn on a separate render thread, which schedules an output render
+// on the main loop once the new frame is ready. must be called from the main
+// loop.
+void bar_request_repaint(struct output *out);
 
 // this is called from a wlc render callback
 void render_bar(struct output *out);
@@ -61,6 +227,7 @@ void init_bar_config();
 void init_bar_threads();
 void init_bar(struct output *out);
 void free_bar(struct bar_t *bar);
+void free_bar_config();
 void stop_bar_threads();
 
 #endif
@@ -0,0 +1,53 @@
+#ifndef __BARHOST_H
+#define __BARHOST_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bar.h"
+
+/*
+ * Optional out-of-process widget host. With 'bar.host = true' the global
+ * widgets don't run in the compositor: wavy-barhost loads the config in its
+ * own process, runs the widget callbacks and rasterizes their strips into a
+ * memfd that is mapped by both processes. The compositor queues widgets by
+ * sending their slot index over a socket and is told about new strips
+ * through an eventfd, so a widget that blocks, leaks or crashes can't take
+ * the compositor down. Per-output widgets still run in-process. If the host
+ * can't be started or goes away, the widgets fall back to the workers.
+ * The host has no layout, so get_layout, get_view_title, get_tiling_symbol
+ * and the layout_* functions don't exist there: a global widget that needs
+ * compositor state can't be hosted, make it per-output or keep 'bar.host'
+ * off.
+ */
+
+// widest strip the host can draw, wider text is clipped
+#define BARHOST_MAX_WIDTH 1024
+
+// one slot per hosted widget in the shared buffer. seq is odd while the host
+// writes the slot, readers retry when it changed under them.
+struct barhost_slot_t {
+    uint32_t seq;
+    uint32_t width;  // 0 if the widget is empty
+    uint32_t height;
+    uint32_t stride;
+    // followed by BARHOST_MAX_WIDTH * height ARGB32 pixels
+};
+
+// size of one slot of the shared buffer for a bar height
+static inline size_t barhost_slot_size(uint32_t height) {
+    return sizeof(struct barhost_slot_t) +
+        (size_t) BARHOST_MAX_WIDTH * 4 * height;
+}
+
+// Starts wavy-barhost if it is enabled in the config. Must be called after
+// init_loop.
+void init_barhost();
+void free_barhost();
+
+// Sends a widget to the host. Returns false if the widget isn't hosted (or
+// the host is gone), it has to run in-process then. Can be called from any
+// thread.
+bool barhost_queue(struct status_entry_t *e);
+
+#endif
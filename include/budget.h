@@ -0,0 +1,61 @@
+#ifndef __BUDGET_H
+#define __BUDGET_H
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "luacompat.h"
+#include "profiler.h"
+
+/*
+ * Instruction and wall clock budgets for lua callbacks. While a callback
+ * runs, a count hook checks every few thousand VM instructions whether it
+ * went over its budget and raises an error if it did, so an endless loop in
+ * a widget or keybinding can't hang the thread running it. A callback that
+ * overran its budget is disabled for a cooldown and tried again afterwards.
+ * Callbacks that wait for a command (see async.h) are measured per resume,
+ * the time spent waiting doesn't count.
+ */
+
+enum budget_kind_t {
+    BUDGET_WIDGET,      // widget callbacks and their 'next' functions
+    BUDGET_KEYBINDING,  // lua keybindings, they run on the main thread
+    BUDGET_KINDS,
+};
+
+// 0 means no limit
+struct budget_limit_t {
+    uint32_t instructions;
+    uint32_t ms;
+};
+
+struct budget_t {
+    struct budget_limit_t limit;
+    int64_t disabled_until; // monotonic ms
+    uint32_t overruns;
+    struct profile_t *profile; // set while profiling, see profiler.h
+    bool transient; // only for one run, an overrun isn't disabled
+};
+
+#ifdef WAVY_BARHOST
+// wavy-barhost has no config, it gets the cooldown in its arguments
+extern uint32_t budget_cooldown;
+#endif
+
+// Resets a budget to the given limits, usually the default ones of a kind of
+// callback from the config that is being read (wavy_config_t.budgets).
+void budget_init(struct budget_t *b, struct budget_limit_t limit);
+
+// Returns false while a callback is disabled after an overrun.
+bool budget_enabled(struct budget_t *b);
+
+// Runs the next lua_pcall/lua_resume of L under the budget, and records it in
+// the profile of the budget if the profiler is on. Every thread can run one
+// budgeted callback at a time.
+void budget_start(lua_State *L, struct budget_t *b);
+
+// Removes the hook again. Returns true if the callback was aborted because
+// it overran its budget, it's logged as 'name' and disabled then (unless the
+// budget is transient).
+bool budget_end(lua_State *L, const char *name);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef __BYTECODE_H
+#define __BYTECODE_H
+#include <stdint.h>
+
+#include "luacompat.h"
+
+/*
+ * Compiled lua chunks. Config files are loaded through a bytecode cache next
+ * to them (config.lua -> config.luac) that is keyed by the mtime, size and a
+ * hash of the source, so they are only parsed when they changed. The
+ * default wavy_utils.lua is built into the binary, precompiled if luac was
+ * found at build time.
+ */
+
+// Like luaL_loadfile, but uses and updates the bytecode cache of the file.
+int bytecode_loadfile(lua_State *L, const char *file);
+
+// Hash of the value at idx. Lua functions are hashed by their stripped
+// bytecode (so moving code around doesn't change it) and their upvalues,
+// strings, numbers and booleans by value. 0 for anything else.
+uint64_t bytecode_hash(lua_State *L, int idx);
+
+// Registers package.preload.wavy_utils. A wavy_utils.lua on package.path is
+// still preferred (through the cache), so edited copies keep working, the
+// built-in one is used if there is none.
+void bytecode_preload(lua_State *L);
+
+#endif
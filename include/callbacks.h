@@ -5,4 +5,8 @@ extern struct wavy_config_t *config;
 
 void set_wlc_callbacks();
 
+// Frees the rate limiting state of the views, must be called before the
+// event loop is torn down.
+void free_callbacks();
+
 #endif
@@ -3,13 +3,12 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <wlc/wlc.h>
-#include <lua.h>
-#include <lualib.h>
-#include <lauxlib.h>
 #include <pthread.h>
 
+#include "luacompat.h"
 #include "vector.h"
 #include "layout.h"
+#include "budget.h"
 
 struct keybind_arg_t {
     void **ptr;
@@ -17,6 +16,7 @@ struct keybind_arg_t {
     enum direction_t dir;
     uint32_t num;
     float f;
+    uint64_t code_hash; // lua bindings: see bytecode_hash
 };
 
 struct keybind_t {
@@ -24,6 +24,7 @@ struct keybind_t {
 	uint32_t mods;
     void (*keybind_f) (struct keybind_t * args, wlc_handle view);
     struct keybind_arg_t args;
+    struct budget_t budget; // lua keybindings only
 };
 
 extern bool debug_enabled;
@@ -37,6 +38,10 @@ void close_view_cmd(struct keybind_t *kb, wlc_handle view);
 void exit_cmd(struct keybind_t *kb, wlc_handle view);
 void spawn_cmd(struct keybind_t *kb, wlc_handle view);
 void lua_cmd(struct keybind_t *kb, wlc_handle view);
+void reload_cmd(struct keybind_t *kb, wlc_handle view);
+
+// resumes a lua keybinding that waited for a command (see async.h)
+void lua_cmd_resume(void *owner, lua_State *co, char *output);
 void cycle_tiling_mode_cmd(struct keybind_t *kb, wlc_handle view);
 void cycle_view_cmd(struct keybind_t *kb, wlc_handle view);
 void new_frame_cmd(struct keybind_t *kb, wlc_handle view);
@@ -51,11 +56,18 @@ void move_cmd(struct keybind_t *kb, wlc_handle view);
 
 void init_commands();
 void free_commands();
+void keybind_free(void *kb);
 
-// inserts/updates commands in the command list.
-void cmd_update(uint32_t mods, uint32_t keysym, struct keybind_arg_t args,
+// inserts/updates commands in a list of *keybind_t's.
+void cmd_update(struct vector_t *cmds, uint32_t mods, uint32_t keysym,
+        struct keybind_arg_t args,
         void (*keybind_f) (struct keybind_t * args, wlc_handle view));
 
+// makes cmds the list of active keybindings and frees the old one. bindings
+// that didn't change keep their budget state. returns how many of them there
+// were. must be called with lua_lock held.
+uint32_t cmd_replace(struct vector_t *cmds);
+
 // gets called every time a key is pressed.
 bool eval_keypress(wlc_handle view, uint32_t mods, uint32_t keysym);
 
@@ -3,12 +3,12 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <lua.h>
-#include <lualib.h>
-#include <lauxlib.h>
 #include <libinput.h>
 
+#include "luacompat.h"
 #include "vector.h"
+#include "budget.h"
+#include "luamem.h"
 
 enum auto_tile_t {
     TILE_UNKNOWN = -1,
@@ -39,6 +39,9 @@ struct wavy_config_t {
     bool        statusbar_separator_enabled;
     uint32_t    statusbar_separator_color;
     uint32_t    statusbar_separator_width;
+    uint32_t    statusbar_workers; // threads running the widget callbacks
+    bool        statusbar_glyph_atlas; // draw ASCII text from a glyph atlas
+    bool        statusbar_host; // run global widgets in wavy-barhost
 
     uint32_t    frame_gaps_size;
     uint32_t    frame_border_size;
@@ -51,8 +54,16 @@ struct wavy_config_t {
     uint32_t    view_border_size;
     uint32_t    view_border_active_color;
     uint32_t    view_border_inactive_color;
+    uint32_t    view_update_interval; // min. ms between title updates of a view
+
+    // default limits of lua callbacks by enum budget_kind_t
+    struct budget_limit_t budgets[BUDGET_KINDS];
+    uint32_t    budget_cooldown; // s a callback is disabled after an overrun
+    uint32_t    profiler_interval; // s between profiler reports, 0 = off
+    uint32_t    lua_memory_limit; // KiB per lua_State before collecting
 
     char        *wallpaper; // file path
+    char        *file;      // path of the loaded config file
 
     enum        auto_tile_t tile_layouts[5];
     char        *tile_layout_strs[5];
@@ -71,4 +82,17 @@ extern char *cmdline_config_file;
 void init_config();
 void free_config();
 
+// Creates a new lua_State and runs the config file in it. Its memory is
+// accounted to subsys (see luamem.h). Returns NULL (and logs the error) if
+// the file can't be loaded or fails to run.
+lua_State *load_config_state(const char *file, enum luamem_subsys_t subsys);
+
+// Reloads the config file without a restart. It is run in a new lua_State
+// and validated on a separate thread, then compared with the live config on
+// the main loop. Only what changed is redone: e.g. new colors just repaint
+// the borders, a new font only redraws the bar. Widgets are restarted if
+// their definition, their code or the globals they might use changed. A
+// config with errors is reported and the live one is kept.
+void config_reload();
+
 #endif
@@ -0,0 +1,47 @@
+#ifndef __EVENTS_H
+#define __EVENTS_H
+#include <stdint.h>
+#include <wlc/wlc.h>
+
+#include "luacompat.h"
+
+/*
+ * Compositor events for lua. Instead of rerunning everything on
+ * hook_view_update, the config can subscribe to typed events with
+ * on_event(names, f) and widgets can list them in 'events'. Events carry
+ * their data (view, output, workspace, title, app_id) and are delivered in
+ * batches: all events of one iteration of the event loop are passed to a
+ * subscriber as one list, and a widget is queued once for them.
+ */
+
+enum event_t {
+    EVENT_VIEW_CREATED = 1 << 0,
+    EVENT_VIEW_DESTROYED = 1 << 1,
+    EVENT_FOCUS_CHANGED = 1 << 2,
+    EVENT_WORKSPACE_SWITCHED = 1 << 3,
+    EVENT_OUTPUT_ADDED = 1 << 4,
+    EVENT_TITLE_CHANGED = 1 << 5
+};
+
+// Queues an event. view, output and workspace (the number, starting at 1)
+// are 0 if they don't apply. The title and app_id of the view are copied
+// right away, the view might be gone when the event is delivered. Main loop
+// only.
+void event_emit(enum event_t type, wlc_handle view, wlc_handle output,
+        uint32_t workspace);
+
+// The event called name ("view_created", "focus_changed", ...), 0 if there
+// is none.
+enum event_t event_str_to_enum(const char *name);
+
+// lua: on_event(names, f) calls f(events) with the list of events of a loop
+// iteration that are in names, a string or a list of strings. Each event is
+// a table with 'type' and the fields that apply: 'view', 'output',
+// 'workspace', 'title' and 'app_id'. Like a keybinding, f is disabled for a
+// while if it overruns its budget.
+int events_subscribe(lua_State *L);
+
+// Drops the events that weren't delivered yet.
+void free_events();
+
+#endif
@@ -2,8 +2,8 @@
 #define __INPUT_H
 
 #include <libinput.h>
-#include <lua.h>
 
+#include "luacompat.h"
 #include "config.h"
 
 struct input_config {
@@ -22,7 +22,8 @@ struct input_config {
 
 extern struct wavy_config_t *config;
 
-void input_configs_init(lua_State *L);
+// reads the 'input' table into c->input_configs
+void input_configs_init(lua_State *L, struct wavy_config_t *c);
 void configure_input(struct libinput_device *device);
 void unconfigure_input(struct libinput_device *device);
 
@@ -31,6 +31,17 @@ struct bar_buffer {
     unsigned char *buffer;
     cairo_t *cr;
     cairo_surface_t *surface;
+    struct wlc_geometry g;  // geometry the buffer was drawn for
+    uint64_t generation;    // 0 means nothing was drawn yet
+};
+
+// layout state a bar is drawn from. it is copied from the compositor's data
+// structures on the main loop, so the bar render thread never reads them.
+struct bar_state {
+    struct wlc_geometry g;
+    uint32_t num_workspaces;
+    int32_t active_ws;  // index of the workspace shown on the output or -1
+    wlc_handle output;  // selects the content of per-output widgets
 };
 
 struct output {
@@ -38,17 +49,31 @@ struct output {
     wlc_handle output_handle;
     struct wlc_geometry g; // geometry adjusted for the statusbar
 
-    // two buffers are used with ping-pong style double buffering to eliminate
-    // rendering artifacts.
+    // three buffers are used for lock-free triple buffering. the bar render
+    // thread draws into 'back' and publishes it by exchanging it with
+    // 'middle'. the render callback takes 'middle' in exchange for 'front'
+    // whenever a newer generation was published. neither side ever waits for
+    // the other. buffers are reallocated one by one when the render thread
+    // draws into them after a resize.
+    //
+    // the fourth buffer holds a frame drawn ahead of time with the next
+    // values of widgets that provide them (see bar_commit_staged).
     struct bar_t {
-        struct bar_buffer *front;
-        struct bar_buffer *back;
-        struct wlc_geometry g;
-        pthread_mutex_t draw_lock;
-
-        // if set, the buffer will be reallocated on the next update.
-        // (used for changing output resolution)
-        bool dirty;
+        struct bar_buffer buffers[4];
+        uint32_t back;              // owned by the render thread
+        uint32_t front;             // owned by the render callback
+        uint32_t middle;            // shared, only accessed atomically
+        uint32_t staged;            // render thread, or commit with the lock
+        uint64_t generation;        // last published generation (atomic)
+
+        // generation a render was last scheduled for (main loop only)
+        uint64_t scheduled;
+
+        // protected by the render queue lock in bar.c
+        struct bar_state state;
+        bool pending;
+        bool stage_pending;     // the staged frame needs to be drawn
+        uint64_t staged_base;   // generation the staged frame follows, or 0
     } bar;
 };
 
@@ -172,6 +197,10 @@ void focus_direction(enum direction_t dir);
 // Focuses a specific view.
 void focus_view(wlc_handle view);
 
+// Called when wlc focused a view. Emits focus_changed unless the layout
+// already did for it.
+void layout_view_focused(wlc_handle view);
+
 // Moves a view in a direction.
 void move_direction(enum direction_t dir);
 
@@ -190,6 +219,21 @@ void cycle_tiling_mode();
 // Cycles the focus through the list of views in the currently active frame.
 void cycle_view_in_frame();
 
+// Applies a changed config to the layout, e.g. after a reload: resizes the
+// outputs for the bar and recalculates and redraws all frames.
+void layout_reconfigure();
+
+// Repaints the frame and view borders of the visible workspaces without
+// moving any views, e.g. after the border colors changed.
+void layout_repaint_borders();
+
+// Starts a batch of layout operations. Until the outermost batch ends, they
+// only note which workspaces need a redraw and whether the bars and outputs
+// need a repaint. Ending it redraws each visible one of those workspaces
+// once and schedules the renders. Main loop only.
+void layout_batch_begin();
+void layout_batch_end();
+
 void free_all_outputs();
 void free_workspaces();
 
@@ -0,0 +1,24 @@
+#ifndef __LOOP_H
+#define __LOOP_H
+#include <stdbool.h>
+
+/*
+ * Hands work over to the compositor's main loop. wlc is not thread-safe, so
+ * threads that need to call into wlc (e.g. to schedule a render) queue a
+ * function here instead. The queue is drained on the next iteration of the
+ * wlc event loop.
+ */
+
+// Runs f(data) on the main loop. Can be called from any thread, including
+// the main loop itself.
+void loop_call(void (*f)(void *data), void *data);
+
+// Whether this is the thread the main loop runs on. False before init_loop.
+bool loop_is_main();
+
+// Registers the wakeup file descriptor with the wlc event loop. Must be
+// called after wlc_init, calls queued earlier are run once the loop starts.
+void init_loop();
+void free_loop();
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef __LUACOMPAT_H
+#define __LUACOMPAT_H
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+/*
+ * Wavy is written against the lua 5.3 C API. With -DWAVY_LUAJIT=ON it is
+ * built against LuaJIT 2.1 instead, which has the 5.1 API plus a few
+ * extensions. This header fills in the rest of what wavy uses: the getters
+ * that return the type of the pushed value, lua_geti, lua_rawlen,
+ * lua_isinteger, lua_getextraspace and friends. Include it instead of the
+ * lua headers. LuaJIT's lua_pushfstring has no '%I', use '%d' with an int.
+ */
+
+#ifdef WAVY_LUAJIT
+#include <stdio.h>
+#include <string.h>
+
+#ifndef LUA_OK
+#define LUA_OK 0
+#endif
+
+#define LUA_PRELOAD_TABLE "_PRELOAD"
+#define LUA_EXTRASPACE (sizeof(void *))
+
+static inline int wavy_absindex(lua_State *L, int idx) {
+    return idx > 0 || idx <= LUA_REGISTRYINDEX ? idx : lua_gettop(L) + idx + 1;
+}
+
+static inline int wavy_getfield(lua_State *L, int idx, const char *k) {
+    lua_getfield(L, idx, k);
+    return lua_type(L, -1);
+}
+
+static inline int wavy_geti(lua_State *L, int idx, lua_Integer i) {
+    idx = wavy_absindex(L, idx);
+    lua_pushinteger(L, i);
+    lua_gettable(L, idx);
+    return lua_type(L, -1);
+}
+
+static inline int wavy_rawget(lua_State *L, int idx) {
+    lua_rawget(L, idx);
+    return lua_type(L, -1);
+}
+
+static inline int wavy_rawgeti(lua_State *L, int idx, int n) {
+    lua_rawgeti(L, idx, n);
+    return lua_type(L, -1);
+}
+
+// all numbers are doubles in LuaJIT
+static inline int wavy_isinteger(lua_State *L, int idx) {
+    if (lua_type(L, idx) != LUA_TNUMBER) {
+        return 0;
+    }
+    lua_Number n = lua_tonumber(L, idx);
+    return n == (lua_Number) (lua_Integer) n;
+}
+
+static inline int wavy_getsubtable(lua_State *L, int idx, const char *name) {
+    idx = wavy_absindex(L, idx);
+    if (wavy_getfield(L, idx, name) == LUA_TTABLE) {
+        return 1;
+    }
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, idx, name);
+    return 0;
+}
+
+// LuaJIT's lua_dump can't strip debug info, but string.dump(f, true) can.
+// hashes of the code (see bytecode_hash) must not depend on line numbers.
+static inline int wavy_dump(lua_State *L, lua_Writer writer, void *data,
+        int strip) {
+
+    if (!strip) {
+        return lua_dump(L, writer, data);
+    }
+    int top = lua_gettop(L);
+    lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+    lua_getfield(L, -1, "string");
+    if (!lua_istable(L, -1)) {
+        lua_settop(L, top);
+        return 1;
+    }
+    lua_getfield(L, -1, "dump");
+    lua_pushvalue(L, top);
+    lua_pushboolean(L, 1);
+    if (lua_pcall(L, 2, 1, 0) != 0 || !lua_isstring(L, -1)) {
+        lua_settop(L, top);
+        return 1;
+    }
+    size_t len;
+    const char *code = lua_tolstring(L, -1, &len);
+    int status = writer(L, code, len, data);
+    lua_settop(L, top);
+    return status;
+}
+
+// kept in a userdata in the registry, so unlike in 5.3 it is shared by all
+// threads of a state instead of copied into new ones
+static inline void *wavy_getextraspace(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, "wavy.extraspace");
+    void *space = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (!space) {
+        space = lua_newuserdata(L, LUA_EXTRASPACE);
+        memset(space, 0, LUA_EXTRASPACE);
+        lua_setfield(L, LUA_REGISTRYINDEX, "wavy.extraspace");
+    }
+    return space;
+}
+
+// lua_getglobal is a macro over lua_getfield, so it returns the type too
+#define lua_getfield(L, idx, k) wavy_getfield(L, idx, k)
+#define lua_geti(L, idx, i) wavy_geti(L, idx, i)
+#define lua_rawget(L, idx) wavy_rawget(L, idx)
+#define lua_rawgeti(L, idx, n) wavy_rawgeti(L, idx, n)
+#define lua_rawlen(L, idx) lua_objlen(L, idx)
+#define lua_absindex(L, idx) wavy_absindex(L, idx)
+#define lua_isinteger(L, idx) wavy_isinteger(L, idx)
+#define lua_getextraspace(L) wavy_getextraspace(L)
+#define lua_pushglobaltable(L) lua_pushvalue(L, LUA_GLOBALSINDEX)
+#define luaL_getsubtable(L, idx, name) wavy_getsubtable(L, idx, name)
+
+// LuaJIT can't resume from another thread
+#define lua_resume(L, from, nargs) lua_resume(L, nargs)
+#define lua_dump(L, writer, data, strip) wavy_dump(L, writer, data, strip)
+
+#define lua_writestringerror(s, p) \
+    (fprintf(stderr, (s), (p)), fflush(stderr))
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __LUAMEM_H
+#define __LUAMEM_H
+#include <stdint.h>
+#include <stddef.h>
+
+#include "luacompat.h"
+
+/*
+ * Allocator for the config's lua_States. Every state gets its own pool of
+ * size classes (16 to 512 bytes) carved from 64 KiB chunks, bigger blocks
+ * go to malloc. A pool is only used by the thread that owns its state, so
+ * the small tables and strings widgets create on every tick don't take the
+ * malloc locks the render threads use. The pools count the bytes allocated
+ * per subsystem. Over the soft limit an allocation fails once, which makes
+ * lua run an emergency collection before it retries.
+ */
+
+enum luamem_subsys_t {
+    LUAMEM_CONFIG,
+    LUAMEM_WIDGETS,
+    LUAMEM_KEYBINDINGS,
+    LUAMEM_SUBSYSTEMS,
+};
+
+struct luamem_stats_t {
+    size_t in_use;          // live bytes of the subsystem's states
+    uint64_t allocated;     // bytes allocated so far
+    uint64_t emergency_gcs; // collections caused by the soft limit
+};
+
+// Creates a lua_State with its own pool, its memory is accounted to subsys.
+lua_State *luamem_newstate(enum luamem_subsys_t subsys);
+
+// Closes a state created with luamem_newstate and frees its pool.
+void luamem_close(lua_State *L);
+
+// Accounts the following allocations of L to another subsystem (e.g. a
+// keybinding running in the config's state). Returns the previous one.
+enum luamem_subsys_t luamem_set_subsys(lua_State *L,
+        enum luamem_subsys_t subsys);
+
+// Soft limit per state in bytes, 0 disables it.
+void luamem_set_limit(size_t bytes);
+
+// Runs the collection a state over the soft limit is due for. Lua 5.3 does
+// that inside the failed allocation, with LuaJIT it has to be called after
+// the callbacks of the state, outside of the allocator.
+void luamem_collect(lua_State *L);
+
+void luamem_stats(enum luamem_subsys_t subsys, struct luamem_stats_t *stats);
+
+const char *luamem_subsys_str(enum luamem_subsys_t subsys);
+
+#endif
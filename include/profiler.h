@@ -0,0 +1,74 @@
+#ifndef __PROFILER_H
+#define __PROFILER_H
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "luacompat.h"
+#include "vector.h"
+
+/*
+ * Profiler for the lua callbacks of the config (widgets and keybindings).
+ * It is enabled with -p or from lua and then records per callback how often
+ * it ran, the time it took, how much it allocated and, through the count
+ * hook that also enforces the budgets (see budget.h), samples of the line
+ * that was executing. The report is sorted by time and written to the log
+ * periodically. Callbacks are identified by their index in the registry of
+ * the config's lua_State and the location of the function.
+ */
+
+// lines of a callback that get their own sample counter, samples of more
+// lines only count for the callback
+#define PROFILE_LINES 64
+
+// a slot of the line table, taken by the first sample of a line
+struct profile_line_t {
+    uint64_t key;           // hash of source and line, 0 while free
+    uint64_t samples;
+    char *location;         // source:line, set after the key
+};
+
+struct profile_t {
+    const char *kind;       // "widget", "keybinding"
+    uint32_t ref;           // lua_reg_idx of the callback in L_config
+    char *location;         // source:line of the function
+
+    // updated atomically by the thread running the callback
+    uint64_t calls;         // runs, resumes after spawn_read count separately
+    uint64_t time_ns;
+    uint64_t max_ns;
+    uint64_t samples;
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+
+    // open addressing by key, lock-free, summed up by profiler_report
+    struct profile_line_t lines[PROFILE_LINES];
+};
+
+bool profiler_enabled();
+
+// Turns profiling on or off. Can be called from any thread.
+void profiler_set_enabled(bool enabled);
+
+// Returns the profile of a callback, creating it on first use. The function
+// is looked up at ref in the registry of L.
+struct profile_t *profiler_get(const char *kind, uint32_t id, lua_State *L,
+        int32_t ref);
+
+// Records a run of a callback on the calling thread.
+void profiler_begin(struct profile_t *p);
+void profiler_end();
+
+// Called from the count hook, attributes a sample to the running line.
+void profiler_sample(lua_State *L);
+
+// Counts the allocations of callbacks running in L.
+void profiler_attach(lua_State *L);
+
+// Returns the report, the caller frees it.
+char *profiler_report();
+
+// Must be called after init_loop, the periodic report runs on the main loop.
+void init_profiler();
+void free_profiler();
+
+#endif
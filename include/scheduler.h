@@ -0,0 +1,28 @@
+#ifndef __SCHEDULER_H
+#define __SCHEDULER_H
+#include <stdint.h>
+
+#include "bar.h"
+
+/*
+ * Fires periodic widgets from a single timer on the wlc event loop. The
+ * timer is always armed for the earliest deadline. Widgets that are due at
+ * the same time are queued as one batch, so they cause at most one bar
+ * repaint. Aligned widgets fire on wall clock multiples of their interval.
+ * While every output is in dpms sleep the timer stops.
+ */
+
+// Wall clock time (ms since the epoch) of the next tick of a periodic widget,
+// calculated from the current time. Can be called from any thread.
+int64_t scheduler_next_tick(struct status_entry_t *e);
+
+// Rearms the timer when an output is drawn again after every output was in
+// dpms sleep, and runs the widgets that were due in the meantime. Cheap
+// otherwise, called before every frame.
+void scheduler_wake();
+
+// Must be called after wlc_init and after the widgets were configured.
+void init_scheduler();
+void free_scheduler();
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <wlc/wlc.h>
+
+#include "luacompat.h"
+#include "layout.h"
+#include "vector.h"
+
+/*
+ * Read-only copy of the layout (outputs, workspaces, frames and views) for
+ * code that runs off the main loop, e.g. widget callbacks on the worker
+ * threads. A new snapshot is built on the main loop when the layout changed,
+ * right before the pending hooks run, so all widgets of a hook cycle see the
+ * same one. Snapshots are reference counted and never modified, readers
+ * don't take any lock once they hold one.
+ *
+ * Lua gets it as userdata with get_layout(). Its fields are looked up in
+ * the snapshot when they are indexed, nothing is copied into tables.
+ */
+
+// the entries refer to each other by index, -1 means none
+struct snap_output_t {
+    wlc_handle handle;
+    struct wlc_geometry g; // geometry adjusted for the statusbar
+    int32_t workspace;
+};
+
+struct snap_workspace_t {
+    uint32_t number;
+    bool visible;
+    int32_t output;
+    int32_t root;
+    int32_t active_frame;
+    uint32_t floating_first; // range of floating views in the view list
+    uint32_t floating_count;
+};
+
+struct snap_frame_t {
+    enum frame_split_t split;
+    const char *symbol; // of the tiling layout
+    int32_t workspace;
+    int32_t parent;
+    int32_t left;
+    int32_t right;
+    struct wlc_geometry g;
+    uint32_t view_first; // range of tiled views in the view list
+    uint32_t view_count;
+    int32_t active_view;
+};
+
+struct snap_view_t {
+    wlc_handle handle;
+    char *title;
+    char *app_id;
+    char *class;
+    struct wlc_geometry g;
+    int32_t workspace;
+    int32_t frame; // -1 for floating views
+    bool floating;
+};
+
+struct snapshot_t {
+    uint32_t refs; // atomic
+    uint64_t serial;
+
+    // *snap_output_t's, *snap_workspace_t's, *snap_frame_t's, *snap_view_t's
+    struct vector_t *outputs;
+    struct vector_t *workspaces;
+    struct vector_t *frames;
+    struct vector_t *views;
+
+    int32_t active_output;
+    int32_t active_workspace;
+    int32_t active_frame;
+    int32_t active_view;
+};
+
+// Marks the layout as changed and queues a flush on the next iteration of the
+// main loop, if none comes earlier. Main loop only.
+void snapshot_invalidate();
+
+// Builds a new snapshot if the layout changed since the last one. Called on
+// the main loop before the pending hooks run.
+void snapshot_flush();
+
+// Returns the current snapshot with a reference held, NULL if there is none
+// yet. Can be called from any thread.
+struct snapshot_t *snapshot_acquire();
+void snapshot_release(struct snapshot_t *s);
+
+// The active frame on an output, or the active frame of the focused output
+// if output is 0. NULL if there is none.
+struct snap_frame_t *snapshot_output_frame(struct snapshot_t *s,
+        wlc_handle output);
+
+// lua: get_layout() returns the current snapshot as userdata (nil before
+// the first one was built)
+int snapshot_get_layout(lua_State *L);
+
+void free_snapshot();
+
+#endif
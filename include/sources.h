@@ -0,0 +1,30 @@
+#ifndef __SOURCES_H
+#define __SOURCES_H
+#include <stdbool.h>
+
+#include "bar.h"
+
+/*
+ * Event sources for bar widgets. Instead of polling, a widget can watch
+ * kernel notifications: network link/address changes (rtnetlink),
+ * power_supply and backlight uevents, and modifications of files (inotify).
+ * The sockets are registered with the wlc event loop and only opened if a
+ * widget needs them. Widgets are queued when one of their sources fires and
+ * the bar is only repainted if their output changed.
+ */
+
+enum source_t {
+    SOURCE_NET = 1 << 0,
+    SOURCE_POWER_SUPPLY = 1 << 1,
+    SOURCE_BACKLIGHT = 1 << 2
+};
+
+// Adds a source to a widget: "net", "power_supply", "backlight" or an
+// absolute path to a file. Returns false if the source is unknown.
+bool widget_watch(struct status_entry_t *e, const char *source);
+
+// Must be called after wlc_init and after the widgets were configured.
+void init_sources();
+void free_sources();
+
+#endif
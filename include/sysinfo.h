@@ -0,0 +1,37 @@
+#ifndef __SYSINFO_H
+#define __SYSINFO_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Cheap access to small kernel files (sysfs, procfs). Files below /sys and
+ * /proc are opened once and the descriptors are kept in a bounded cache,
+ * every read is a single pread from offset 0, which makes the kernel
+ * regenerate the content. A descriptor whose file went away is dropped and
+ * the file opened again. Other files are opened for every read. All
+ * functions are thread-safe.
+ */
+
+// Reads a whole file into buf (NUL-terminated, trailing newline removed).
+// Returns the length or -1 on error, failed opens are retried on the next
+// call.
+ssize_t sysinfo_read(const char *path, char *buf, size_t size);
+
+// Reads a file containing a single integer.
+bool sysinfo_read_int(const char *path, int64_t *val);
+
+// Reads a value from /proc/meminfo (in kB), e.g. "MemAvailable".
+bool sysinfo_meminfo(const char *key, int64_t *kb);
+
+// Used space of the file system containing path in percent, rounded up like
+// df does. Returns -1 on error.
+int32_t sysinfo_fs_used_percent(const char *path);
+
+// IPv4 address of a network device in dotted notation. Returns false if the
+// device doesn't exist or has no address.
+bool sysinfo_ipv4_address(const char *dev, char *buf, size_t size);
+
+void free_sysinfo();
+
+#endif
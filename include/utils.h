@@ -2,10 +2,8 @@
 #define __UTILS_H
 #include <stdint.h>
 #include <cairo/cairo.h>
-#include <lua.h>
-#include <lauxlib.h>
-#include <lualib.h>
 
+#include "luacompat.h"
 #include "bar.h"
 #include "config.h"
 
@@ -31,6 +29,15 @@ enum auto_tile_t tiling_layout_str_to_enum(const char *str);
 // a shell.
 void cmd_exec(const char *bin, char *const *args);
 
+// Milliseconds on the monotonic clock.
+int64_t monotonic_ms();
+
+// Message handler for lua_pcall that prints a stacktrace.
+int traceback_msghandler(lua_State *L);
+
+// Runs a shell command, blocks until it exits and pushes its output.
+int spawn_read_blocking(lua_State *L, const char *cmd);
+
 // Print the tree of frames (sideways).
 void print_frame_tree(struct frame *fr);
 
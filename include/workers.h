@@ -0,0 +1,31 @@
+#ifndef __WORKERS_H
+#define __WORKERS_H
+#include <stdint.h>
+
+#include "bar.h"
+
+/*
+ * A small pool of threads that runs the lua callbacks of the bar widgets.
+ * Every worker has its own lua_State loaded from the config file, so widget
+ * callbacks never take lua_lock and a slow widget can't block keybindings.
+ * Callbacks run in coroutines, a widget waiting for a command started with
+ * spawn_read is suspended and the worker goes on with the other widgets.
+ * Each widget is pinned to one worker, so widgets that keep state in
+ * upvalues always see the same state.
+ */
+
+// Starts the workers. Must be called after the config was loaded.
+void init_workers();
+void stop_workers();
+
+// Queues widgets for their workers. Widgets queued with one call are run as
+// one batch per worker and cause at most one repaint per worker. Can be
+// called from any thread.
+void queue_widgets(struct status_entry_t **entries, uint32_t count);
+
+// Like queue_widgets, but per-output widgets only run for one output (0 means
+// all outputs).
+void queue_widgets_output(struct status_entry_t **entries, uint32_t count,
+        wlc_handle output);
+
+#endif
@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <wlc/wlc.h>
+
+#include "luacompat.h"
+#include "async.h"
+#include "loop.h"
+#include "log.h"
+#include "utils.h"
+#include "vector.h"
+
+// registry keys
+#define ASYNC_RUNNER "wavy_async_runner"
+#define ASYNC_THREADS "wavy_async_threads"
+
+struct async_runner_t {
+    async_resume_t resume;
+    void *owner;
+};
+
+struct spawn_t {
+    int fd;
+    struct wlc_event_source *src;
+    char *buf;
+    size_t len;
+    size_t size;
+    struct async_runner_t runner;
+    lua_State *co;
+    bool dropped; // by async_drop before the main loop watched it
+};
+
+// *spawn_t's of running commands. src is set once the main loop watches
+// them. protected by spawns_lock.
+static struct vector_t *spawns = NULL;
+static pthread_mutex_t spawns_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void async_set_runner(lua_State *L, async_resume_t resume, void *owner) {
+    struct async_runner_t *r =
+        lua_newuserdata(L, sizeof(struct async_runner_t));
+    r->resume = resume;
+    r->owner = owner;
+    lua_setfield(L, LUA_REGISTRYINDEX, ASYNC_RUNNER);
+}
+
+// pushes the table of coroutines created by async_thread_new
+static void push_threads(lua_State *L) {
+    if (lua_getfield(L, LUA_REGISTRYINDEX, ASYNC_THREADS) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, ASYNC_THREADS);
+    }
+}
+
+lua_State *async_thread_new(lua_State *L) {
+    lua_State *co = lua_newthread(L);
+
+    // anchor the coroutine, this also marks it as one that may yield
+    push_threads(L);
+    lua_pushvalue(L, -2);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, -3);
+    lua_pop(L, 2);
+
+    lua_xmove(L, co, 1);
+    return co;
+}
+
+void async_thread_free(lua_State *L, lua_State *co) {
+    push_threads(L);
+    lua_pushthread(co);
+    lua_xmove(co, L, 1);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+}
+
+bool async_threads_pending(lua_State *L) {
+    push_threads(L);
+    lua_pushnil(L);
+    bool pending = lua_next(L, -2) != 0;
+    lua_settop(L, pending ? -4 : -2);
+    return pending;
+}
+
+int async_resume(lua_State *co, int nargs) {
+    int status = lua_resume(co, NULL, nargs);
+    if (status != LUA_OK && status != LUA_YIELD) {
+        const char *msg = lua_tostring(co, -1);
+        luaL_traceback(co, co, msg ? msg : "(error object)", 0);
+        lua_writestringerror("%s\n", lua_tostring(co, -1));
+        lua_settop(co, 0);
+    }
+    return status;
+}
+
+// returns the runner if L is a coroutine created by async_thread_new
+static struct async_runner_t *get_runner(lua_State *L) {
+    struct async_runner_t *r = NULL;
+
+    if (!lua_isyieldable(L)) {
+        return NULL;
+    }
+
+    // coroutines created in lua itself don't count, yielding would return
+    // to their caller instead of the runner
+    push_threads(L);
+    lua_pushthread(L);
+    bool tracked = lua_rawget(L, -2) == LUA_TBOOLEAN;
+    lua_pop(L, 2);
+
+    if (tracked &&
+        lua_getfield(L, LUA_REGISTRYINDEX, ASYNC_RUNNER) == LUA_TUSERDATA) {
+        r = lua_touserdata(L, -1);
+    }
+    lua_pop(L, 1);
+    return r;
+}
+
+// starts 'sh -c cmd' with stdout connected to a pipe. the command is run in
+// a grandchild, so it never becomes a zombie. returns the read end.
+static int spawn_pipe(const char *cmd) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        return -1;
+    }
+
+    pid_t p = fork();
+    if (p == 0) {
+        if (fork() == 0) {
+            setsid();
+            dup2(fds[1], STDOUT_FILENO);
+            execl("/bin/sh", "/bin/sh", "-c", cmd, NULL);
+        }
+        _exit(EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    if (p < 0) {
+        close(fds[0]);
+        return -1;
+    }
+    waitpid(p, NULL, 0);
+    return fds[0];
+}
+
+// must be called with spawns_lock held
+static void spawn_remove(struct spawn_t *s) {
+    for (uint32_t i = 0; spawns && i < spawns->length; i++) {
+        if (spawns->items[i] == s) {
+            vector_del(spawns, i);
+            break;
+        }
+    }
+}
+
+static void spawn_free(struct spawn_t *s) {
+    if (s->src) {
+        wlc_event_source_remove(s->src);
+    }
+    close(s->fd);
+    free(s->buf);
+    free(s);
+}
+
+static int spawn_readable(int fd, uint32_t mask, void *arg) {
+    (void) mask;
+    struct spawn_t *s = arg;
+
+    for (;;) {
+        if (s->size - s->len < 512) {
+            size_t size = s->size ? s->size * 2 : 1024;
+            char *buf = realloc(s->buf, size);
+            if (!buf) {
+                wavy_log(LOG_ERROR, "Failed to allocate command output");
+                break;
+            }
+            s->buf = buf;
+            s->size = size;
+        }
+
+        ssize_t n = read(fd, s->buf + s->len, s->size - s->len - 1);
+        if (n > 0) {
+            s->len += n;
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return 0; // wait for more
+        }
+        break; // end of output or error
+    }
+
+    pthread_mutex_lock(&spawns_lock);
+    spawn_remove(s);
+    pthread_mutex_unlock(&spawns_lock);
+
+    char *output = s->buf ? s->buf : malloc(1);
+    if (output) {
+        output[s->len] = 0;
+    }
+    s->buf = NULL;
+    s->runner.resume(s->runner.owner, s->co, output);
+    spawn_free(s);
+    return 0;
+}
+
+// main loop side of spawn_read
+static void spawn_watch(void *data) {
+    struct spawn_t *s = data;
+    pthread_mutex_lock(&spawns_lock);
+    if (s->dropped) {
+        pthread_mutex_unlock(&spawns_lock);
+        spawn_free(s);
+        return;
+    }
+    s->src = wlc_event_loop_add_fd(s->fd, WLC_EVENT_READABLE, spawn_readable,
+            s);
+    pthread_mutex_unlock(&spawns_lock);
+}
+
+int async_spawn_read(lua_State *L) {
+    const char *cmd = luaL_checkstring(L, 1);
+    struct async_runner_t *r = get_runner(L);
+    if (!r) {
+        // the caller can't yield
+        return spawn_read_blocking(L, cmd);
+    }
+
+    struct spawn_t *s = calloc(1, sizeof(struct spawn_t));
+    if (!s) {
+        return luaL_error(L, "Failed to allocate command state");
+    }
+    s->fd = spawn_pipe(cmd);
+    if (s->fd < 0) {
+        free(s);
+        lua_pushstring(L, "");
+        return 1;
+    }
+    fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+    s->runner = *r;
+    s->co = L;
+
+    pthread_mutex_lock(&spawns_lock);
+    if (!spawns) {
+        spawns = vector_init();
+    }
+    vector_add(spawns, s);
+    pthread_mutex_unlock(&spawns_lock);
+
+    // wlc isn't thread-safe, the pipe is registered from the main loop. the
+    // output is passed to the coroutine when it is resumed.
+    loop_call(spawn_watch, s);
+    return lua_yield(L, 0);
+}
+
+void async_drop(void *owner) {
+    pthread_mutex_lock(&spawns_lock);
+    for (uint32_t i = 0; spawns && i < spawns->length;) {
+        struct spawn_t *s = spawns->items[i];
+        if (s->runner.owner != owner) {
+            i++;
+            continue;
+        }
+        vector_del(spawns, i);
+        if (s->src) {
+            spawn_free(s);
+        } else {
+            s->dropped = true; // freed by spawn_watch
+        }
+    }
+    pthread_mutex_unlock(&spawns_lock);
+}
+
+void free_async() {
+    pthread_mutex_lock(&spawns_lock);
+    if (spawns) {
+        for (uint32_t i = 0; i < spawns->length; i++) {
+            spawn_free(spawns->items[i]);
+        }
+        vector_free(spawns);
+        spawns = NULL;
+    }
+    pthread_mutex_unlock(&spawns_lock);
+}
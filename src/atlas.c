@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <cairo/cairo.h>
+#include <pango/pangocairo.h>
+
+#include "atlas.h"
+#include "log.h"
+
+#define MAX(a,b) (((a) > (b)) ? (a) : (b))
+
+struct glyph_atlas_t *atlas_create(const char *font) {
+    struct glyph_atlas_t *atlas = calloc(1, sizeof(struct glyph_atlas_t));
+    if (!atlas) {
+        return NULL;
+    }
+    atlas->font = strdup(font);
+
+    // the layout needs a context, the glyphs are drawn into their own
+    // surfaces
+    cairo_surface_t *tmp = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+    cairo_t *tmp_cr = cairo_create(tmp);
+    PangoLayout *layout = pango_cairo_create_layout(tmp_cr);
+    PangoFontDescription *desc = pango_font_description_from_string(font);
+    pango_layout_set_font_description(layout, desc);
+    pango_font_description_free(desc);
+
+    bool ok = true;
+    for (uint32_t c = ATLAS_FIRST_CHAR; c <= ATLAS_LAST_CHAR; c++) {
+        struct glyph_t *g = &atlas->glyphs[c - ATLAS_FIRST_CHAR];
+        char str[2] = { (char) c, 0 };
+        int w, h;
+
+        pango_layout_set_text(layout, str, 1);
+        pango_layout_get_pixel_size(layout, &w, &h);
+        g->advance = w;
+        atlas->height = MAX(atlas->height, (uint32_t) h);
+
+        g->mask = cairo_image_surface_create(CAIRO_FORMAT_A8, MAX(w, 1),
+                MAX(h, 1));
+        if (cairo_surface_status(g->mask) != CAIRO_STATUS_SUCCESS) {
+            ok = false;
+            break;
+        }
+        cairo_t *cr = cairo_create(g->mask);
+        cairo_set_source_rgba(cr, 0, 0, 0, 1);
+        pango_cairo_update_layout(cr, layout);
+        pango_cairo_show_layout(cr, layout);
+        cairo_destroy(cr);
+        cairo_surface_flush(g->mask);
+    }
+
+    g_object_unref(layout);
+    cairo_destroy(tmp_cr);
+    cairo_surface_destroy(tmp);
+
+    if (!ok) {
+        wavy_log(LOG_ERROR, "Failed to create glyph atlas for %s", font);
+        atlas_free(atlas);
+        return NULL;
+    }
+    return atlas;
+}
+
+void atlas_free(struct glyph_atlas_t *atlas) {
+    if (!atlas) {
+        return;
+    }
+    for (uint32_t i = 0; i <= ATLAS_LAST_CHAR - ATLAS_FIRST_CHAR; i++) {
+        if (atlas->glyphs[i].mask) {
+            cairo_surface_destroy(atlas->glyphs[i].mask);
+        }
+    }
+    free(atlas->font);
+    free(atlas);
+}
+
+bool atlas_measure(struct glyph_atlas_t *atlas, const char *text,
+        uint32_t *width, uint32_t *height) {
+
+    uint32_t w = 0;
+    for (const unsigned char *c = (const unsigned char *) text; *c; c++) {
+        if (*c < ATLAS_FIRST_CHAR || *c > ATLAS_LAST_CHAR) {
+            return false;
+        }
+        w += atlas->glyphs[*c - ATLAS_FIRST_CHAR].advance;
+    }
+    *width = w;
+    *height = atlas->height;
+    return true;
+}
+
+void atlas_draw(struct glyph_atlas_t *atlas, cairo_t *cr, const char *text,
+        double x, double y) {
+
+    for (const unsigned char *c = (const unsigned char *) text; *c; c++) {
+        struct glyph_t *g = &atlas->glyphs[*c - ATLAS_FIRST_CHAR];
+        if (*c != ' ') {
+            cairo_mask_surface(cr, g->mask, x, y);
+        }
+        x += g->advance;
+    }
+}
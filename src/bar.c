@@ -1,39 +1,99 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <cairo/cairo.h>
 #include <pango/pangocairo.h>
 #include <wlc/wlc-render.h>
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
-#include <lua.h>
-#include <lualib.h>
-#include <lauxlib.h>
 
+#include "luacompat.h"
 #include "bar.h"
 #include "config.h"
 #include "utils.h"
 #include "layout.h"
 #include "log.h"
 #include "vector.h"
+#include "loop.h"
+#include "workers.h"
+#include "atlas.h"
+#include "snapshot.h"
 
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #define MAX(a,b) (((a) > (b)) ? (a) : (b))
 
-static void update_all_bars() {
-    struct vector_t *outs = get_outputs();
-    for (uint32_t i = 0; i < outs->length; i++) {
-        struct output *out = outs->items[i];
-        update_bar(out);
-        wlc_output_schedule_render(out->output_handle);
+// outputs that have a bar, in the order they were added. the render thread
+// only ever looks at this list, never at the compositor's output vector.
+static struct vector_t *bar_outputs = NULL;
+
+// protects bar_outputs, the queued state of all bars and the fields below
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t render_cond = PTHREAD_COND_INITIALIZER;
+static struct output *rendering = NULL;   // bar the thread is drawing
+static bool render_quit = false;
+static pthread_t render_thread;
+
+// set while a render scheduling call is queued on the main loop
+static bool schedule_queued = false;
+
+// hooks requested with hook_request, flushed by the next output render. the
+// counters are read from other threads.
+static uint32_t hooks_pending = 0; // main loop only
+static wlc_handle hooks_pending_output[HOOK_UNKNOWN]; // 0 means all outputs
+static uint64_t hooks_requested[HOOK_UNKNOWN];
+static uint64_t hooks_executed[HOOK_UNKNOWN];
+
+// glyph atlas for plain ASCII text, only used by the render thread
+static struct glyph_atlas_t *atlas = NULL;
+
+// font (with its size) the atlas couldn't be built for, the bar uses Pango
+// for it instead of trying again on every draw
+static char *atlas_failed_font = NULL;
+
+// protects the text and colors of the status entries. the hook threads
+// replace them while the render thread draws them.
+static pthread_mutex_t widget_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void bar_request_repaint_all() {
+    pthread_mutex_lock(&render_lock);
+    if (bar_outputs) {
+        for (uint32_t i = 0; i < bar_outputs->length; i++) {
+            struct output *out = bar_outputs->items[i];
+            out->bar.pending = true;
+        }
+    }
+    pthread_cond_signal(&render_cond);
+    pthread_mutex_unlock(&render_lock);
+}
+
+void bar_request_repaint_output(wlc_handle output) {
+    pthread_mutex_lock(&render_lock);
+    if (bar_outputs) {
+        for (uint32_t i = 0; i < bar_outputs->length; i++) {
+            struct output *out = bar_outputs->items[i];
+            if (out->output_handle == output) {
+                out->bar.pending = true;
+                pthread_cond_signal(&render_cond);
+                break;
+            }
+        }
     }
+    pthread_mutex_unlock(&render_lock);
 }
 
-void add_widget(enum side_t side, enum hook_t hook, int lua_ref) {
+struct status_entry_t *widget_new(enum side_t side, enum hook_t hook,
+        int lua_ref, uint32_t config_idx, uint32_t interval_ms, bool align) {
+
     struct status_entry_t *new_widget;
     new_widget = calloc(1, sizeof(struct status_entry_t));
     if (!new_widget) {
-        return;
+        wavy_log(LOG_ERROR, "Failed to allocate widget");
+        exit(EXIT_FAILURE);
+    }
+
+    if (interval_ms == 0) {
+        interval_ms = (hook == HOOK_PERIODIC_FAST) ? 1000 : 30000;
     }
 
     new_widget->hook = hook;
@@ -41,47 +101,251 @@ void add_widget(enum side_t side, enum hook_t hook, int lua_ref) {
     new_widget->bg_color = 0;
     new_widget->fg_color = 0;
     new_widget->lua_reg_idx = lua_ref;
-    vector_add(status_entries, new_widget);
+    new_widget->config_idx = config_idx;
+    new_widget->interval_ms = interval_ms;
+    new_widget->align = align;
+    new_widget->next_ms = 0; // periodic widgets fire once on startup
+    new_widget->host_slot = -1;
+    return new_widget;
+}
+
+static void free_strip(struct widget_strip_t *s);
+
+void widget_free(void *data) {
+    struct status_entry_t *e = data;
+    free(e->entry);
+    free_strip(&e->strip);
+    free_strip(&e->next_strip);
+    free_strip(&e->host_strip);
+    free(e->next_entry);
+    if (e->watch_files) {
+        vector_foreach(e->watch_files, free);
+        vector_free(e->watch_files);
+    }
+    for (uint32_t i = 0; e->slots && i < e->slots->length; i++) {
+        struct widget_slot_t *s = e->slots->items[i];
+        free(s->entry);
+        free(s);
+    }
+    if (e->slots) {
+        vector_free(e->slots);
+    }
+    free(e);
 }
 
-static void update_entry(struct status_entry_t *entry) {
-    lua_rawgeti(L_config, LUA_REGISTRYINDEX, entry->lua_reg_idx);
-    lua_pcall(L_config, 0, 1, 0);
-    if (!lua_istable(L_config, -1)) {
-        luaL_error(L_config,
-                "Statusbar callback function returned a %s instead of a table",
-                lua_typename(L_config, -1));
+bool widget_equal(struct status_entry_t *a, struct status_entry_t *b) {
+    if (a->hook != b->hook || a->side != b->side ||
+        a->config_idx != b->config_idx || a->interval_ms != b->interval_ms ||
+        a->align != b->align || a->scope != b->scope ||
+        a->precompute != b->precompute || a->watch != b->watch ||
+        a->events != b->events || a->code_hash != b->code_hash ||
+        a->budget.limit.instructions != b->budget.limit.instructions ||
+        a->budget.limit.ms != b->budget.limit.ms) {
+        return false;
     }
 
-    if (entry->entry) {
-        free(entry->entry);
-        entry->entry = NULL;
+    uint32_t files = a->watch_files ? a->watch_files->length : 0;
+    if (files != (b->watch_files ? b->watch_files->length : 0)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < files; i++) {
+        if (strcmp(a->watch_files->items[i], b->watch_files->items[i])) {
+            return false;
+        }
     }
+    return true;
+}
 
-    if (lua_geti(L_config, -1, 1) == LUA_TNUMBER &&
-        lua_geti(L_config, -2, 2) == LUA_TNUMBER &&
-        lua_geti(L_config, -3, 3) == LUA_TSTRING) {
+struct vector_t *get_widgets() {
+    return status_entries;
+}
 
-        entry->entry = strdup(lua_tostring(L_config, -1));
-        entry->fg_color = lua_tointeger(L_config, -2);
-        entry->bg_color = lua_tointeger(L_config, -3);
-        lua_pop(L_config, 3);
-    } else {
-        luaL_error(L_config,
-                "Invalid entry in table returned by a statusbar callback");
+// must be called with widget_lock held
+static struct widget_slot_t *find_slot(struct status_entry_t *e,
+        wlc_handle output) {
+
+    for (uint32_t i = 0; e->slots && i < e->slots->length; i++) {
+        struct widget_slot_t *s = e->slots->items[i];
+        if (s->output == output) {
+            return s;
+        }
     }
+    return NULL;
 }
 
-void trigger_hook(enum hook_t hook) {
-    pthread_mutex_lock(&lua_lock);
+static bool set_slot_content(struct status_entry_t *e, wlc_handle output,
+        const char *text, uint32_t fg_color, uint32_t bg_color) {
+
+    // the output might have disappeared while the widget was running
+    char *old = NULL;
+    bool changed = false;
+    pthread_mutex_lock(&widget_lock);
+    struct widget_slot_t *s = find_slot(e, output);
+    if (s && (!s->entry || strcmp(s->entry, text) ||
+              s->fg_color != fg_color || s->bg_color != bg_color)) {
+        old = s->entry;
+        s->entry = strdup(text);
+        s->fg_color = fg_color;
+        s->bg_color = bg_color;
+        changed = true;
+    }
+    pthread_mutex_unlock(&widget_lock);
+    free(old);
+    return changed;
+}
+
+bool set_widget_content(struct status_entry_t *e, wlc_handle output,
+        const char *text, uint32_t fg_color, uint32_t bg_color) {
+
+    if (e->scope == SCOPE_OUTPUT) {
+        return set_slot_content(e, output, text, fg_color, bg_color);
+    }
+
+    // the scheduler may have committed staged content in the meantime, so
+    // the comparison needs the lock as well
+    pthread_mutex_lock(&widget_lock);
+    if (e->entry && !strcmp(e->entry, text) &&
+        e->fg_color == fg_color && e->bg_color == bg_color) {
+        pthread_mutex_unlock(&widget_lock);
+        return false;
+    }
+
+    char *old = e->entry;
+    e->entry = strdup(text);
+    e->fg_color = fg_color;
+    e->bg_color = bg_color;
+    e->content_gen++;
+    pthread_mutex_unlock(&widget_lock);
+    free(old);
+    return true;
+}
+
+void set_widget_host_strip(struct status_entry_t *e, cairo_surface_t *surface,
+        uint32_t width, uint32_t height) {
+
+    pthread_mutex_lock(&widget_lock);
+    cairo_surface_t *old = e->host_strip.surface;
+    e->host_strip.surface = surface;
+    e->host_strip.width = width;
+    e->host_strip.height = height;
+    e->host_strip.gen++;
+    pthread_mutex_unlock(&widget_lock);
+    if (old) {
+        cairo_surface_destroy(old);
+    }
+}
+
+void stage_widget_content(struct status_entry_t *e, const char *text,
+        uint32_t fg_color, uint32_t bg_color) {
+
+    pthread_mutex_lock(&widget_lock);
+    bool same = e->has_next && !strcmp(e->next_entry, text) &&
+                e->next_fg_color == fg_color && e->next_bg_color == bg_color;
+    if (!same) {
+        free(e->next_entry);
+        e->next_entry = strdup(text);
+        e->next_fg_color = fg_color;
+        e->next_bg_color = bg_color;
+        e->next_gen++;
+        e->has_next = true;
+    }
+    pthread_mutex_unlock(&widget_lock);
+
+    if (same) {
+        return;
+    }
+
+    pthread_mutex_lock(&render_lock);
+    for (uint32_t i = 0; bar_outputs && i < bar_outputs->length; i++) {
+        struct output *out = bar_outputs->items[i];
+        out->bar.stage_pending = true;
+    }
+    pthread_cond_signal(&render_cond);
+    pthread_mutex_unlock(&render_lock);
+}
+
+void widget_mark_dirty(struct status_entry_t *e, wlc_handle output) {
+    pthread_mutex_lock(&widget_lock);
+    for (uint32_t i = 0; e->slots && i < e->slots->length; i++) {
+        struct widget_slot_t *s = e->slots->items[i];
+        if (!output || s->output == output) {
+            s->dirty = true;
+        }
+    }
+    pthread_mutex_unlock(&widget_lock);
+}
+
+bool widget_take_dirty(struct status_entry_t *e, wlc_handle *output) {
+    bool found = false;
+    pthread_mutex_lock(&widget_lock);
+    for (uint32_t i = 0; e->slots && i < e->slots->length; i++) {
+        struct widget_slot_t *s = e->slots->items[i];
+        if (s->dirty) {
+            s->dirty = false;
+            *output = s->output;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&widget_lock);
+    return found;
+}
+
+void trigger_hook_output(enum hook_t hook, wlc_handle output) {
+    struct vector_t *batch = vector_init();
     for (uint32_t i = 0; i < status_entries->length; i++) {
         struct status_entry_t *e = status_entries->items[i];
         if (e->hook == hook) {
-            update_entry(e);
+            vector_add(batch, e);
+        }
+    }
+    queue_widgets_output((struct status_entry_t **) batch->items,
+            batch->length, output);
+    vector_free(batch);
+}
+
+void trigger_hook(enum hook_t hook) {
+    trigger_hook_output(hook, 0);
+}
+
+void hook_request(enum hook_t hook, wlc_handle output) {
+    __atomic_add_fetch(&hooks_requested[hook], 1, __ATOMIC_RELAXED);
+    snapshot_invalidate();
+    if (hooks_pending & (1 << hook)) {
+        // requested for different outputs, run it for all of them
+        if (hooks_pending_output[hook] != output) {
+            hooks_pending_output[hook] = 0;
+        }
+        return;
+    }
+    hooks_pending |= 1 << hook;
+    hooks_pending_output[hook] = output;
+
+    // make sure there is a render cycle that flushes the hook
+    wlc_handle render = output ? output : wlc_get_focused_output();
+    if (render) {
+        wlc_output_schedule_render(render);
+    }
+}
+
+void hook_flush() {
+    // the hooks' widgets share one snapshot of the changed layout
+    snapshot_flush();
+
+    uint32_t pending = hooks_pending;
+    hooks_pending = 0;
+    for (uint32_t h = 0; pending; h++) {
+        if (pending & (1 << h)) {
+            pending &= ~(1 << h);
+            __atomic_add_fetch(&hooks_executed[h], 1, __ATOMIC_RELAXED);
+            trigger_hook_output(h, hooks_pending_output[h]);
         }
     }
-    pthread_mutex_unlock(&lua_lock);
-    update_all_bars();
+}
+
+void hook_stats(enum hook_t hook, uint64_t *requested, uint64_t *executed) {
+    *requested = __atomic_load_n(&hooks_requested[hook], __ATOMIC_RELAXED);
+    *executed = __atomic_load_n(&hooks_executed[hook], __ATOMIC_RELAXED);
 }
 
 static PangoLayout *setup_pango_layout(cairo_t *cr, char *text) {
@@ -109,18 +373,135 @@ static void draw_text(cairo_t *cr, PangoLayout *layout, uint32_t w, uint32_t h,
     pango_cairo_show_layout(cr, layout);
 }
 
-static void draw_workspace_indicators(struct output *out, cairo_t *cr) {
-    struct vector_t *workspaces = get_workspaces();
+// text prepared for drawing, either from the glyph atlas or with Pango
+struct bar_text_t {
+    const char *text;
+    PangoLayout *layout; // NULL if the atlas is used
+    uint32_t width;
+    uint32_t height;
+};
+
+// returns the glyph atlas if it is enabled, (re)building it for the
+// configured font
+static struct glyph_atlas_t *get_atlas() {
+    if (!config->statusbar_glyph_atlas) {
+        return NULL;
+    }
+    if (atlas && strcmp(atlas->font, config->statusbar_font)) {
+        atlas_free(atlas);
+        atlas = NULL;
+    }
+    if (!atlas && (!atlas_failed_font ||
+                strcmp(atlas_failed_font, config->statusbar_font))) {
+        free(atlas_failed_font);
+        atlas_failed_font = NULL;
+        atlas = atlas_create(config->statusbar_font);
+        if (!atlas) {
+            atlas_failed_font = strdup(config->statusbar_font);
+        }
+    }
+    return atlas;
+}
+
+static void text_prepare(cairo_t *cr, const char *text, struct bar_text_t *t) {
+    struct glyph_atlas_t *a = get_atlas();
+    t->text = text;
+    t->layout = NULL;
+    if (a && atlas_measure(a, text, &t->width, &t->height)) {
+        return;
+    }
+
+    // anything but printable ASCII goes through Pango
+    int width, height;
+    t->layout = setup_pango_layout(cr, (char *) text);
+    pango_layout_get_size(t->layout, &width, &height);
+    t->width = width / PANGO_SCALE;
+    t->height = height / PANGO_SCALE;
+}
+
+// draws prepared text centered in a box and releases it
+static void text_draw(cairo_t *cr, struct bar_text_t *t, uint32_t w,
+        uint32_t h, uint32_t x, uint32_t y) {
+
+    if (t->layout) {
+        pango_cairo_update_layout(cr, t->layout);
+        draw_text(cr, t->layout, w, h, x, y);
+        g_object_unref(t->layout);
+        t->layout = NULL;
+    } else {
+        atlas_draw(atlas, cr, t->text, x + ((int) w - (int) t->width)/2,
+                y + ((int) h - (int) t->height)/2);
+    }
+}
+
+// returns the strip of a global widget, drawing it first if the content
+// changed. cr is only used to set up the text layout. must be called with
+// widget_lock held.
+static struct widget_strip_t *widget_strip(struct status_entry_t *e,
+        cairo_t *cr, bool staged) {
+
+    // the staged frame shows the next content of widgets that have one
+    struct widget_strip_t *s = &e->strip;
+    char *entry = e->entry;
+    uint32_t bg_color = e->bg_color;
+    uint32_t fg_color = e->fg_color;
+    uint64_t gen = e->content_gen;
+    if (staged && e->has_next) {
+        s = &e->next_strip;
+        entry = e->next_entry;
+        bg_color = e->next_bg_color;
+        fg_color = e->next_fg_color;
+        gen = e->next_gen;
+    }
+
+    uint32_t bar_height = config->statusbar_height;
+    if (s->surface && s->gen == gen && s->height == bar_height) {
+        return s;
+    }
+
+    struct bar_text_t text;
+    text_prepare(cr, entry, &text);
+    uint32_t width = text.width + 2*config->statusbar_padding;
+
+    if (s->surface) {
+        cairo_surface_destroy(s->surface);
+    }
+    s->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width,
+            bar_height);
+    s->width = width;
+    s->height = bar_height;
+    s->gen = gen;
+
+    // same operator as the bar buffers, so the result is identical to
+    // drawing the widget into the bar directly
+    cairo_t *scr = cairo_create(s->surface);
+    cairo_set_operator(scr, CAIRO_OPERATOR_SOURCE);
+    cr_set_argb_color(scr, bg_color);
+    cairo_paint(scr);
+    cr_set_argb_color(scr, fg_color);
+    text_draw(scr, &text, width, bar_height, 0, 0);
+    cairo_destroy(scr);
+
+    return s;
+}
+
+static void free_strip(struct widget_strip_t *s) {
+    if (s->surface) {
+        cairo_surface_destroy(s->surface);
+        s->surface = NULL;
+    }
+}
+
+static void draw_workspace_indicators(struct bar_state *st, cairo_t *cr) {
     uint32_t ws_rect_width = 20;
     uint32_t bar_height = config->statusbar_height;
 
-    for (unsigned i = 0; i < workspaces->length; i++) {
-        struct workspace *ws = workspaces->items[i];
+    for (uint32_t i = 0; i < st->num_workspaces; i++) {
         uint32_t ws_color;
         uint32_t font_color;
 
         // background color
-        if (ws->is_visible && out == ws->assigned_output) {
+        if ((int32_t) i == st->active_ws) {
             ws_color = config->statusbar_active_ws_color;
             font_color = config->statusbar_active_ws_font_color;
         } else {
@@ -133,18 +514,19 @@ static void draw_workspace_indicators(struct output *out, cairo_t *cr) {
                 bar_height);
         cairo_fill(cr);
 
-        char num[8];
-        sprintf(num, "%d", ws->number + 1); // lets use 1-indexed workspaces
+        char num[16];
+        sprintf(num, "%u", i + 1); // lets use 1-indexed workspaces
 
-        PangoLayout *layout = setup_pango_layout(cr, num);
+        struct bar_text_t text;
+        text_prepare(cr, num, &text);
         cr_set_argb_color(cr, font_color);
-        draw_text(cr, layout, ws_rect_width, bar_height,
-                i*ws_rect_width, out->bar.g.origin.y);
-        g_object_unref(layout);
+        text_draw(cr, &text, ws_rect_width, bar_height, i*ws_rect_width, 0);
     }
 }
 
-static void draw_data(struct bar_t *bar, cairo_t *cr) {
+// draws the widgets. 'staged' selects the next content of widgets that have
+// one staged.
+static void draw_data(struct bar_state *st, cairo_t *cr, bool staged) {
     if (!status_entries) { // possibly uninitialized
         return;
     }
@@ -154,8 +536,8 @@ static void draw_data(struct bar_t *bar, cairo_t *cr) {
     uint32_t gap = config->statusbar_gap;
 
     // add gap so the rightmost element is flush with the end of the screen
-    uint32_t prev_x_right = bar->g.size.w + gap;
-    uint32_t prev_x_left = (get_workspaces())->length * 20;
+    uint32_t prev_x_right = st->g.size.w + gap;
+    uint32_t prev_x_left = st->num_workspaces * 20;
 
     uint32_t sep_x = 0;
     uint32_t sep_h = bar_height * 0.6; // a factor of 0.6 seems to look nice
@@ -165,9 +547,23 @@ static void draw_data(struct bar_t *bar, cairo_t *cr) {
     bool first_right = true;
     bool first_left = true;
 
+    pthread_mutex_lock(&widget_lock);
     for (uint32_t i = 0; i < status_entries->length; i++) {
         struct status_entry_t *e = status_entries->items[i];
-        if (!e->entry || strlen(e->entry) == 0 ) {
+        char *entry = (staged && e->has_next) ? e->next_entry : e->entry;
+        uint32_t bg_color = e->bg_color;
+        uint32_t fg_color = e->fg_color;
+        if (e->scope == SCOPE_OUTPUT) {
+            struct widget_slot_t *s = find_slot(e, st->output);
+            if (!s) {
+                continue;
+            }
+            entry = s->entry;
+            bg_color = s->bg_color;
+            fg_color = s->fg_color;
+        }
+        bool hosted = e->scope == SCOPE_GLOBAL && e->host_strip.surface;
+        if (!hosted && (!entry || strlen(entry) == 0)) {
             continue;
         }
 
@@ -176,13 +572,23 @@ static void draw_data(struct bar_t *bar, cairo_t *cr) {
             break;
         }
 
-        int text_width, text_height;
-        PangoLayout *layout = setup_pango_layout(cr, e->entry);
-        pango_layout_get_size(layout, &text_width, &text_height);
-        text_width /= PANGO_SCALE;
+        // global widgets are rasterized once and shared by all outputs,
+        // per-output widgets are drawn directly
+        struct widget_strip_t *strip = NULL;
+        struct bar_text_t text;
+        uint32_t width;
+        if (hosted) {
+            strip = &e->host_strip;
+            width = strip->width;
+        } else if (e->scope == SCOPE_GLOBAL) {
+            strip = widget_strip(e, cr, staged);
+            width = strip->width;
+        } else {
+            text_prepare(cr, entry, &text);
+            width = text.width + 2*padding;
+        }
 
         uint32_t x = 0;
-        uint32_t width = text_width + 2*padding;
 
         if (e->side == SIDE_RIGHT) {
             sep_x = prev_x_right - (gap / 2) - sep_w;
@@ -195,15 +601,20 @@ static void draw_data(struct bar_t *bar, cairo_t *cr) {
             sep_x = x - (gap / 2) - sep_w;
         }
 
-        // background
-        cr_set_argb_color(cr, e->bg_color);
-        cairo_rectangle(cr, x, 0, width, bar_height);
-        cairo_fill(cr);
+        if (strip) {
+            cairo_set_source_surface(cr, strip->surface, x, 0);
+            cairo_rectangle(cr, x, 0, width, bar_height);
+            cairo_fill(cr);
+        } else {
+            // background
+            cr_set_argb_color(cr, bg_color);
+            cairo_rectangle(cr, x, 0, width, bar_height);
+            cairo_fill(cr);
 
-        // text
-        cr_set_argb_color(cr, e->fg_color);
-        draw_text(cr, layout, width, bar_height, x, bar->g.origin.y);
-        g_object_unref(layout);
+            // text
+            cr_set_argb_color(cr, fg_color);
+            text_draw(cr, &text, width, bar_height, x, 0);
+        }
 
         // separator
         if (config->statusbar_separator_enabled &&
@@ -226,165 +637,479 @@ static void draw_data(struct bar_t *bar, cairo_t *cr) {
             first_left = false;
         }
     }
+    pthread_mutex_unlock(&widget_lock);
 }
 
-static void alloc_bar(struct output *out) {
-    int stride = 4 * out->bar.g.size.w;
+// (re)allocates a single buffer if its size doesn't match the bar anymore
+static void bar_buffer_realloc(struct bar_buffer *buf,
+        struct wlc_geometry *g) {
 
-    // front buffer
-    out->bar.front->buffer = calloc(stride * out->bar.g.size.h,
-            sizeof(unsigned char));
-    out->bar.front->surface = cairo_image_surface_create_for_data(
-            out->bar.front->buffer, CAIRO_FORMAT_ARGB32, out->bar.g.size.w,
-            out->bar.g.size.h, stride);
-    out->bar.front->cr = cairo_create(out->bar.front->surface);
+    if (buf->buffer && buf->g.size.w == g->size.w &&
+        buf->g.size.h == g->size.h) {
+        buf->g = *g;
+        return;
+    }
 
-    // back buffer
-    out->bar.back->buffer = calloc(stride * out->bar.g.size.h,
-            sizeof(unsigned char));
-    out->bar.back->surface = cairo_image_surface_create_for_data(
-            out->bar.back->buffer, CAIRO_FORMAT_ARGB32, out->bar.g.size.w,
-            out->bar.g.size.h, stride);
-    out->bar.back->cr = cairo_create(out->bar.back->surface);
+    if (buf->surface) {
+        cairo_destroy(buf->cr);
+        cairo_surface_destroy(buf->surface);
+    }
+    free(buf->buffer);
+
+    int stride = 4 * g->size.w;
+    buf->g = *g;
+    buf->buffer = calloc(stride * g->size.h, sizeof(unsigned char));
+    buf->surface = cairo_image_surface_create_for_data(buf->buffer,
+            CAIRO_FORMAT_ARGB32, g->size.w, g->size.h, stride);
+    buf->cr = cairo_create(buf->surface);
+
+    // when drawing over other stuff, replace the destination layer.
+    // this means transparent elements like background/workspace aren't
+    // composed, the color/transparency of the last drawn layer is applied.
+    cairo_set_operator(buf->cr, CAIRO_OPERATOR_SOURCE);
 }
 
-void update_bar(struct output *out) {
-    // prevent concurrent use of cairo objects
-    pthread_mutex_lock(&out->bar.draw_lock);
+// draws the bar of an output into its back buffer and publishes it. only
+// ever called from the render thread.
+static void draw_bar(struct bar_buffer *buf, struct bar_state *st,
+        bool staged) {
+
+    bar_buffer_realloc(buf, &st->g);
+
+    // background
+    cr_set_argb_color(buf->cr, config->statusbar_bg_color);
+    cairo_paint(buf->cr);
+
+    // workspaces
+    draw_workspace_indicators(st, buf->cr);
+
+    // user defined statusbar elements
+    draw_data(st, buf->cr, staged);
+
+    cairo_surface_flush(buf->surface);
+}
+
+static bool has_staged_content() {
+    bool staged = false;
+    pthread_mutex_lock(&widget_lock);
+    for (uint32_t i = 0; i < status_entries->length; i++) {
+        struct status_entry_t *e = status_entries->items[i];
+        staged |= e->has_next;
+    }
+    pthread_mutex_unlock(&widget_lock);
+    return staged;
+}
 
-    // reallocate the bar if the dirty bit indicates a change of the bar size
-    if (out->bar.dirty) {
-        out->bar.g.origin.x = 0;
-        out->bar.g.origin.y = (config->statusbar_position == POS_TOP) ? 0 :
-                                out->g.size.h;
-        out->bar.g.size.w = out->g.size.w;
-        out->bar.g.size.h = config->statusbar_height;
-        if (out->bar.front->buffer) {
-            free(out->bar.front->buffer);
+// draws the frame with the staged widget content into the staged buffer. it
+// can only be committed as long as no other frame was published.
+static void update_staged_bar(struct output *out, struct bar_state *st) {
+    if (st->g.size.w == 0 || st->g.size.h == 0) {
+        return;
+    }
+
+    uint64_t base = out->bar.generation;
+    draw_bar(&out->bar.buffers[out->bar.staged], st, true);
+
+    pthread_mutex_lock(&render_lock);
+    out->bar.staged_base = base;
+    pthread_mutex_unlock(&render_lock);
+}
+
+static void update_bar(struct output *out, struct bar_state *st) {
+    if (st->g.size.w == 0 || st->g.size.h == 0) {
+        return; // no layout state was copied yet
+    }
+
+    struct bar_buffer *back = &out->bar.buffers[out->bar.back];
+    draw_bar(back, st, false);
+
+    // publish the finished frame. the generation is stored after the
+    // exchange, so a reader seeing it is guaranteed to find the new frame
+    // (or a newer one) in the middle slot.
+    uint64_t gen = out->bar.generation + 1;
+    back->generation = gen;
+    out->bar.back = __atomic_exchange_n(&out->bar.middle, out->bar.back,
+            __ATOMIC_ACQ_REL);
+    __atomic_store_n(&out->bar.generation, gen, __ATOMIC_RELEASE);
+}
+
+// runs on the main loop after the render thread published new frames
+static void schedule_bar_renders(void *data) {
+    (void) data;
+    __atomic_store_n(&schedule_queued, false, __ATOMIC_RELEASE);
+
+    struct vector_t *outs = get_outputs();
+    for (uint32_t i = 0; i < outs->length; i++) {
+        struct output *out = outs->items[i];
+        uint64_t gen = __atomic_load_n(&out->bar.generation, __ATOMIC_ACQUIRE);
+        if (gen != out->bar.scheduled) {
+            out->bar.scheduled = gen;
+            wlc_output_schedule_render(out->output_handle);
         }
-        if (out->bar.back->buffer) {
-            free(out->bar.back->buffer);
+    }
+}
+
+static void *render_thread_func(void *arg) {
+    (void) arg;
+
+    pthread_mutex_lock(&render_lock);
+    while (!render_quit) {
+        struct output *out = NULL;
+        // regular frames go first, staged frames are drawn when idle
+        for (uint32_t i = 0; bar_outputs && i < bar_outputs->length; i++) {
+            struct output *o = bar_outputs->items[i];
+            if (o->bar.pending) {
+                out = o;
+                break;
+            } else if (o->bar.stage_pending && !out) {
+                out = o;
+            }
         }
-        if (out->bar.front->surface) {
-            cairo_surface_destroy(out->bar.front->surface);
-            cairo_destroy(out->bar.front->cr);
+
+        if (!out) {
+            pthread_cond_wait(&render_cond, &render_lock);
+            continue;
+        }
+
+        // draw from a copy of the state, so the main loop can queue new
+        // state while this frame is being drawn
+        struct bar_state st = out->bar.state;
+        bool staged = !out->bar.pending;
+        out->bar.pending = false;
+        out->bar.stage_pending = false;
+        rendering = out;
+        pthread_mutex_unlock(&render_lock);
+
+        if (staged) {
+            update_staged_bar(out, &st);
+            pthread_mutex_lock(&render_lock);
+            rendering = NULL;
+            pthread_cond_broadcast(&render_cond);
+            continue;
         }
-        if (out->bar.back->surface) {
-            cairo_surface_destroy(out->bar.back->surface);
-            cairo_destroy(out->bar.back->cr);
+
+        update_bar(out, &st);
+
+        // a new frame makes the staged one outdated
+        bool restage = has_staged_content();
+
+        // only one scheduling call needs to be queued at a time, it looks at
+        // the latest generation of every output
+        if (!__atomic_exchange_n(&schedule_queued, true, __ATOMIC_ACQ_REL)) {
+            loop_call(schedule_bar_renders, NULL);
         }
-        alloc_bar(out);
-        out->bar.dirty = false;
 
-        // when drawing over other stuff, replace the destination layer.
-        // this means transparent elements like background/workspace aren't
-        // composed, the color/transparency of the last drawn layer is applied.
-        cairo_set_operator(out->bar.front->cr, CAIRO_OPERATOR_SOURCE);
-        cairo_set_operator(out->bar.back->cr, CAIRO_OPERATOR_SOURCE);
+        pthread_mutex_lock(&render_lock);
+        out->bar.stage_pending |= restage;
+        rendering = NULL;
+        pthread_cond_broadcast(&render_cond);
     }
+    pthread_mutex_unlock(&render_lock);
+    return NULL;
+}
 
-    // background
-    cr_set_argb_color(out->bar.back->cr, config->statusbar_bg_color);
-    cairo_paint(out->bar.back->cr);
+void bar_commit_staged(struct status_entry_t **entries, uint32_t count) {
+    pthread_mutex_lock(&render_lock);
 
-    // workspaces
-    draw_workspace_indicators(out, out->bar.back->cr);
+    // the strips and the staged buffers belong to the render thread while
+    // it draws. committing then would be racy, the widgets will be redrawn
+    // with their real content anyway.
+    if (rendering) {
+        pthread_mutex_unlock(&render_lock);
+        return;
+    }
 
-    // user defined statusbar elements
-    draw_data(&out->bar, out->bar.back->cr);
+    // the staged frames can only be shown if they don't contain the next
+    // content of widgets that aren't due yet
+    bool complete = true;
+    bool committed = false;
+    pthread_mutex_lock(&widget_lock);
+    for (uint32_t i = 0; i < status_entries->length; i++) {
+        struct status_entry_t *e = status_entries->items[i];
+        if (!e->has_next) {
+            continue;
+        }
+        bool due = false;
+        for (uint32_t j = 0; j < count; j++) {
+            due |= entries[j] == e;
+        }
+        if (!due) {
+            complete = false;
+            continue;
+        }
+
+        free(e->entry);
+        e->entry = e->next_entry;
+        e->fg_color = e->next_fg_color;
+        e->bg_color = e->next_bg_color;
+        e->next_entry = NULL;
+        e->has_next = false;
+        e->content_gen++;
+
+        // the strip of the next content is most likely drawn already
+        if (e->next_strip.surface && e->next_strip.gen == e->next_gen) {
+            struct widget_strip_t tmp = e->strip;
+            e->strip = e->next_strip;
+            e->strip.gen = e->content_gen;
+            e->next_strip = tmp;
+        }
+        committed = true;
+    }
+    pthread_mutex_unlock(&widget_lock);
+
+    if (!committed) {
+        pthread_mutex_unlock(&render_lock);
+        return;
+    }
 
-    cairo_surface_flush(out->bar.back->surface);
+    for (uint32_t i = 0; i < bar_outputs->length; i++) {
+        struct output *out = bar_outputs->items[i];
+        struct bar_t *bar = &out->bar;
+        if (complete && !bar->pending && bar->staged_base &&
+            bar->staged_base == bar->generation) {
 
-    // swap the front/back buffer
-    struct bar_buffer *tmp = out->bar.back;
-    out->bar.back = out->bar.front;
-    out->bar.front = tmp;
+            // publish the staged frame like update_bar publishes the back
+            // buffer
+            uint64_t gen = bar->generation + 1;
+            bar->buffers[bar->staged].generation = gen;
+            bar->staged = __atomic_exchange_n(&bar->middle, bar->staged,
+                    __ATOMIC_ACQ_REL);
+            __atomic_store_n(&bar->generation, gen, __ATOMIC_RELEASE);
+        } else {
+            bar->pending = true;
+        }
+        bar->staged_base = 0;
+    }
+    pthread_cond_signal(&render_cond);
+    pthread_mutex_unlock(&render_lock);
 
-    pthread_mutex_unlock(&out->bar.draw_lock);
+    // we are on the main loop already
+    schedule_bar_renders(NULL);
+}
+
+void bar_request_repaint(struct output *out) {
+    snapshot_invalidate();
+
+    struct bar_state st;
+    st.g.origin.x = 0;
+    st.g.origin.y = (config->statusbar_position == POS_TOP) ? 0 :
+                        out->g.size.h;
+    st.g.size.w = out->g.size.w;
+    st.g.size.h = config->statusbar_height;
+    st.output = out->output_handle;
+
+    struct vector_t *workspaces = get_workspaces();
+    st.num_workspaces = workspaces->length;
+    st.active_ws = -1;
+    for (uint32_t i = 0; i < workspaces->length; i++) {
+        struct workspace *ws = workspaces->items[i];
+        if (ws->is_visible && out == ws->assigned_output) {
+            st.active_ws = i;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&render_lock);
+    out->bar.state = st;
+    out->bar.pending = true;
+    pthread_cond_signal(&render_cond);
+    pthread_mutex_unlock(&render_lock);
 }
 
 void render_bar(struct output *out) {
-    if (!out || !out->bar.front->buffer) {
+    if (!out) {
         return;
     }
-    wlc_pixels_write(WLC_RGBA8888, &out->bar.g, out->bar.front->buffer);
+
+    // only touch the shared slot if a newer frame than ours was published
+    uint64_t gen = __atomic_load_n(&out->bar.generation, __ATOMIC_ACQUIRE);
+    if (gen > out->bar.buffers[out->bar.front].generation) {
+        out->bar.front = __atomic_exchange_n(&out->bar.middle, out->bar.front,
+                __ATOMIC_ACQ_REL);
+    }
+
+    struct bar_buffer *front = &out->bar.buffers[out->bar.front];
+    if (!front->generation) {
+        return;
+    }
+    wlc_pixels_write(WLC_RGBA8888, &front->g, front->buffer);
 }
 
-void init_bar_config() {
-    status_entries = vector_init();
+// must be called with widget_lock held
+static void add_slot(struct status_entry_t *e, wlc_handle output) {
+    if (e->scope != SCOPE_OUTPUT) {
+        return;
+    }
+    struct widget_slot_t *s = calloc(1, sizeof(struct widget_slot_t));
+    if (!s) {
+        wavy_log(LOG_ERROR, "Failed to allocate widget slot");
+        exit(EXIT_FAILURE);
+    }
+    s->output = output;
+    if (!e->slots) {
+        e->slots = vector_init();
+    }
+    vector_add(e->slots, s);
 }
 
-static void *hook_thread_slow_func(void *arg) {
-    (void) arg;
-    while (1) {
-        trigger_hook(HOOK_PERIODIC_SLOW);
-        sleep(30);
+void bar_replace_widgets(struct vector_t *widgets) {
+    // the render thread draws from the list, wait until it's done
+    pthread_mutex_lock(&render_lock);
+    while (rendering) {
+        pthread_cond_wait(&render_cond, &render_lock);
     }
-    return NULL;
+
+    pthread_mutex_lock(&widget_lock);
+    struct vector_t *old = status_entries;
+    status_entries = widgets;
+    for (uint32_t i = 0; i < widgets->length; i++) {
+        for (uint32_t j = 0; j < bar_outputs->length; j++) {
+            struct output *out = bar_outputs->items[j];
+            add_slot(widgets->items[i], out->output_handle);
+        }
+    }
+    pthread_mutex_unlock(&widget_lock);
+
+    // the staged frames show the old widgets
+    for (uint32_t i = 0; i < bar_outputs->length; i++) {
+        struct output *out = bar_outputs->items[i];
+        out->bar.staged_base = 0;
+        out->bar.pending = true;
+    }
+    pthread_cond_signal(&render_cond);
+    pthread_mutex_unlock(&render_lock);
+
+    vector_foreach(old, widget_free);
+    vector_free(old);
 }
 
-static void *hook_thread_fast_func(void *arg) {
-    (void) arg;
-    while (1) {
-        trigger_hook(HOOK_PERIODIC_FAST);
-        sleep(1);
+void bar_pause_render() {
+    pthread_mutex_lock(&render_lock);
+    while (rendering) {
+        pthread_cond_wait(&render_cond, &render_lock);
     }
-    return NULL;
 }
 
-static void *trigger_all_hooks(void *arg) {
-    (void) arg;
-    for (uint32_t i = 0; i < 5; i++) {
-        trigger_hook(i);
+void bar_resume_render(bool restyle) {
+    if (restyle) {
+        atlas_free(atlas);
+        atlas = NULL;
+        for (uint32_t i = 0; i < status_entries->length; i++) {
+            struct status_entry_t *e = status_entries->items[i];
+            free_strip(&e->strip);
+            free_strip(&e->next_strip);
+        }
+        bool staged = has_staged_content();
+        for (uint32_t i = 0; i < bar_outputs->length; i++) {
+            struct output *out = bar_outputs->items[i];
+            out->bar.staged_base = 0;
+            out->bar.stage_pending = staged;
+        }
     }
-    return NULL;
+    pthread_cond_signal(&render_cond);
+    pthread_mutex_unlock(&render_lock);
+}
+
+void init_bar_config() {
+    status_entries = vector_init();
+    bar_outputs = vector_init();
 }
 
 void init_bar_threads() {
-    pthread_create(&hook_thread_fast, NULL, hook_thread_fast_func, NULL);
-    pthread_create(&hook_thread_slow, NULL, hook_thread_slow_func, NULL);
+    pthread_create(&render_thread, NULL, render_thread_func, NULL);
 }
 
 void init_bar(struct output *out) {
-    out->bar.dirty = true; // buffers will be allocated on next update
-    pthread_mutex_init(&out->bar.draw_lock, NULL);
-    out->bar.front = calloc(1, sizeof(struct bar_buffer));
-    if (!out->bar.front) {
-        wavy_log(LOG_ERROR, "Failed to allocate bar_buffer struct");
-        exit(EXIT_FAILURE);
-    }
-    out->bar.back = calloc(1, sizeof(struct bar_buffer));
-    if (!out->bar.front) {
-        free(out->bar.front);
-        wavy_log(LOG_ERROR, "Failed to allocate bar_buffer struct");
-        exit(EXIT_FAILURE);
+    out->bar.back = 0;
+    out->bar.middle = 1;
+    out->bar.front = 2;
+    out->bar.staged = 3;
+    out->bar.staged_base = 0;
+    out->bar.stage_pending = false;
+    out->bar.generation = 0;
+    out->bar.scheduled = 0;
+    out->bar.pending = false;
+
+    pthread_mutex_lock(&render_lock);
+    vector_add(bar_outputs, out);
+    pthread_mutex_unlock(&render_lock);
+
+    // per-output widgets get a slot for the new output
+    pthread_mutex_lock(&widget_lock);
+    for (uint32_t i = 0; i < status_entries->length; i++) {
+        add_slot(status_entries->items[i], out->output_handle);
     }
+    pthread_mutex_unlock(&widget_lock);
 
-    // trigger all the hooks once on initialization. use a separate thread
-    // so startup isn't blocked by a slow script.
-    pthread_t init_hooks_thread;
-    pthread_create(&init_hooks_thread, NULL, trigger_all_hooks, NULL);
+    // update all widgets once on initialization. this doesn't block startup,
+    // the widgets are run by the worker threads.
+    queue_widgets_output((struct status_entry_t **) status_entries->items,
+            status_entries->length, out->output_handle);
 }
 
 void free_bar(struct bar_t *bar) {
-    for (uint32_t i = 0; i < status_entries->length; i++) {
+    // remove the bar from the render queue and wait until the render thread
+    // is done with it
+    wlc_handle output = 0;
+    pthread_mutex_lock(&render_lock);
+    for (uint32_t i = 0; i < bar_outputs->length; i++) {
+        struct output *out = bar_outputs->items[i];
+        if (&out->bar == bar) {
+            output = out->output_handle;
+            vector_del(bar_outputs, i);
+            while (rendering == out) {
+                pthread_cond_wait(&render_cond, &render_lock);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&render_lock);
+
+    pthread_mutex_lock(&widget_lock);
+    for (uint32_t i = 0; output && i < status_entries->length; i++) {
         struct status_entry_t *e = status_entries->items[i];
-        if (e->entry) {
-            free(e->entry);
+        for (uint32_t j = 0; e->slots && j < e->slots->length; j++) {
+            struct widget_slot_t *s = e->slots->items[j];
+            if (s->output == output) {
+                free(s->entry);
+                free(s);
+                vector_del(e->slots, j);
+                break;
+            }
         }
-        free(e);
     }
-    vector_free(status_entries);
+    pthread_mutex_unlock(&widget_lock);
+
+    for (uint32_t i = 0; i < 4; i++) {
+        struct bar_buffer *buf = &bar->buffers[i];
+        if (buf->surface) {
+            cairo_destroy(buf->cr);
+            cairo_surface_destroy(buf->surface);
+        }
+        free(buf->buffer);
+    }
+}
+
+void free_bar_config() {
+    atlas_free(atlas);
+    atlas = NULL;
+    free(atlas_failed_font);
+    atlas_failed_font = NULL;
 
-    cairo_surface_destroy(bar->front->surface);
-    cairo_surface_destroy(bar->back->surface);
-    cairo_destroy(bar->front->cr);
-    cairo_destroy(bar->back->cr);
-    free(bar->front->buffer);
-    free(bar->back->buffer);
+    uint64_t requested, executed;
+    hook_stats(HOOK_VIEW_UPDATE, &requested, &executed);
+    wavy_log(LOG_DEBUG, "View update hook: %" PRIu64 " requested, %" PRIu64
+            " executed", requested, executed);
+
+    vector_foreach(status_entries, widget_free);
+    vector_free(status_entries);
+    vector_free(bar_outputs);
 }
 
 void stop_bar_threads() {
-    pthread_cancel(hook_thread_slow);
-    pthread_cancel(hook_thread_fast);
+    pthread_mutex_lock(&render_lock);
+    render_quit = true;
+    pthread_cond_signal(&render_cond);
+    pthread_mutex_unlock(&render_lock);
+    pthread_join(render_thread, NULL);
 }
@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <cairo/cairo.h>
+#include <wlc/wlc.h>
+
+#include "barhost.h"
+#include "workers.h"
+#include "config.h"
+#include "loop.h"
+#include "log.h"
+
+static pid_t host_pid = -1;
+static int control_fd = -1; // our end of the socket to the host
+static int event_fd = -1;
+static struct wlc_event_source *control_src = NULL;
+static struct wlc_event_source *event_src = NULL;
+static void *shm = NULL;
+static size_t shm_size = 0;
+static uint32_t shm_height = 0;
+
+// hosted widgets by slot and the last seq read from each slot
+static struct status_entry_t **slots = NULL;
+static uint32_t *slot_seqs = NULL;
+static uint32_t num_slots = 0;
+
+static bool running = false; // atomic
+
+static struct barhost_slot_t *get_slot(uint32_t i) {
+    return (struct barhost_slot_t *)
+        ((char *) shm + i * barhost_slot_size(shm_height));
+}
+
+// copies the strip of a slot if the host wrote a new one. returns true if
+// the strip of the widget changed.
+static bool read_slot(uint32_t i) {
+    struct barhost_slot_t *s = get_slot(i);
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (seq == slot_seqs[i] || seq & 1) {
+        return false; // unchanged, or the host is still writing it
+    }
+
+    uint32_t width = s->width;
+    uint32_t height = s->height;
+    uint32_t stride = s->stride;
+    cairo_surface_t *surface = NULL;
+    if (width > 0 && width <= BARHOST_MAX_WIDTH && height == shm_height &&
+        stride >= width * 4 && stride <= BARHOST_MAX_WIDTH * 4) {
+        surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width,
+                height);
+        cairo_surface_flush(surface);
+        unsigned char *dst = cairo_image_surface_get_data(surface);
+        int32_t dst_stride = cairo_image_surface_get_stride(surface);
+        unsigned char *src = (unsigned char *) (s + 1);
+        for (uint32_t y = 0; y < height; y++) {
+            memcpy(dst + y*dst_stride, src + y*stride, width * 4);
+        }
+        cairo_surface_mark_dirty(surface);
+    }
+
+    // torn read, the host signals again when it's done
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) {
+        if (surface) {
+            cairo_surface_destroy(surface);
+        }
+        return false;
+    }
+
+    slot_seqs[i] = seq;
+    set_widget_host_strip(slots[i], surface, width, height);
+    return true;
+}
+
+static int event_readable(int fd, uint32_t mask, void *arg) {
+    (void) mask;
+    (void) arg;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        return 0;
+    }
+
+    bool changed = false;
+    for (uint32_t i = 0; i < num_slots; i++) {
+        changed |= read_slot(i);
+    }
+    if (changed) {
+        bar_request_repaint_all();
+    }
+    return 0;
+}
+
+static void stop_host() {
+    if (event_src) {
+        wlc_event_source_remove(event_src);
+        event_src = NULL;
+    }
+    if (control_src) {
+        wlc_event_source_remove(control_src);
+        control_src = NULL;
+    }
+    if (host_pid > 0) {
+        kill(host_pid, SIGKILL);
+        waitpid(host_pid, NULL, 0);
+        host_pid = -1;
+    }
+}
+
+// main loop side of losing the host: the widgets go back to the workers
+static void host_lost(void *data) {
+    (void) data;
+    if (host_pid < 0) {
+        return; // already handled
+    }
+    wavy_log(LOG_ERROR, "wavy-barhost exited, running widgets in-process");
+    stop_host();
+    for (uint32_t i = 0; i < num_slots; i++) {
+        set_widget_host_strip(slots[i], NULL, 0, 0);
+    }
+    queue_widgets(slots, num_slots);
+    bar_request_repaint_all();
+}
+
+static void mark_lost() {
+    if (__atomic_exchange_n(&running, false, __ATOMIC_ACQ_REL)) {
+        loop_call(host_lost, NULL);
+    }
+}
+
+// the host never writes to the socket, so this only fires when it's gone
+static int control_readable(int fd, uint32_t mask, void *arg) {
+    (void) mask;
+    (void) arg;
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN)) {
+        mark_lost();
+    }
+    return 0;
+}
+
+bool barhost_queue(struct status_entry_t *e) {
+    if (e->host_slot < 0 || !__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    // one packet per request. if the host is that far behind, the request
+    // is dropped, it still has older ones for the widget to work through.
+    uint32_t slot = e->host_slot;
+    if (send(control_fd, &slot, sizeof(slot), MSG_NOSIGNAL | MSG_DONTWAIT) < 0
+        && errno != EAGAIN) {
+        mark_lost();
+        return false;
+    }
+    return true;
+}
+
+// the host binary next to ours, e.g. in the build directory, or from $PATH.
+// resolved before the fork, execvp isn't async-signal-safe. NULL if there is
+// none.
+static char *host_path() {
+    char exe[4096];
+    char path[4096 + 16];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len > 0) {
+        exe[len] = 0;
+        snprintf(path, sizeof(path), "%s/wavy-barhost", dirname(exe));
+        if (access(path, X_OK) == 0) {
+            return strdup(path);
+        }
+    }
+
+    const char *env = getenv("PATH");
+    char *dirs = strdup(env ? env : "/usr/local/bin:/usr/bin:/bin");
+    char *save = NULL;
+    for (char *dir = dirs ? strtok_r(dirs, ":", &save) : NULL; dir;
+            dir = strtok_r(NULL, ":", &save)) {
+        snprintf(path, sizeof(path), "%s/wavy-barhost", dir);
+        if (access(path, X_OK) == 0) {
+            free(dirs);
+            return strdup(path);
+        }
+    }
+    free(dirs);
+    return NULL;
+}
+
+static char *fmt_uint(uint32_t n) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u", n);
+    return strdup(buf);
+}
+
+// starts the host with its end of the socket and the shared fds. returns
+// false if it couldn't be started.
+static bool spawn_host(int shm_fd, int host_fd) {
+    // argv: config, shm fd, eventfd, socket, height, padding, font, the
+    // widget budget and cooldown, then the widgets' positions in the config,
+    // one per slot
+    uint32_t argc = 11 + num_slots;
+    char **argv = calloc(argc + 1, sizeof(char *));
+    if (!argv) {
+        return false;
+    }
+    argv[0] = host_path();
+    if (!argv[0]) {
+        wavy_log(LOG_ERROR, "wavy-barhost not found");
+        free(argv);
+        return false;
+    }
+    argv[1] = strdup(config->file);
+    argv[2] = fmt_uint(shm_fd);
+    argv[3] = fmt_uint(event_fd);
+    argv[4] = fmt_uint(host_fd);
+    argv[5] = fmt_uint(shm_height);
+    argv[6] = fmt_uint(config->statusbar_padding);
+    argv[7] = strdup(config->statusbar_font);
+    argv[8] = fmt_uint(config->budgets[BUDGET_WIDGET].instructions);
+    argv[9] = fmt_uint(config->budgets[BUDGET_WIDGET].ms);
+    argv[10] = fmt_uint(config->budget_cooldown);
+    for (uint32_t i = 0; i < num_slots; i++) {
+        argv[11 + i] = fmt_uint(slots[i]->config_idx);
+    }
+
+    // only async-signal-safe calls after fork, the compositor has threads
+    pid_t p = fork();
+    if (p == 0) {
+        fcntl(shm_fd, F_SETFD, 0);
+        fcntl(event_fd, F_SETFD, 0);
+        fcntl(host_fd, F_SETFD, 0);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    for (uint32_t i = 0; i < argc; i++) {
+        free(argv[i]);
+    }
+    free(argv);
+    if (p < 0) {
+        return false;
+    }
+    host_pid = p;
+    return true;
+}
+
+void init_barhost() {
+    if (!config->statusbar_host) {
+        return;
+    }
+
+    struct vector_t *widgets = get_widgets();
+    slots = calloc(widgets->length, sizeof(struct status_entry_t *));
+    slot_seqs = calloc(widgets->length, sizeof(uint32_t));
+    if (!slots || !slot_seqs) {
+        wavy_log(LOG_ERROR, "Failed to allocate bar host slots");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < widgets->length; i++) {
+        struct status_entry_t *e = widgets->items[i];
+        if (e->scope == SCOPE_GLOBAL) {
+            slots[num_slots++] = e;
+        }
+    }
+    if (num_slots == 0) {
+        return;
+    }
+
+    shm_height = config->statusbar_height;
+    shm_size = num_slots * barhost_slot_size(shm_height);
+
+    int sv[2] = {-1, -1};
+    int shm_fd = memfd_create("wavy-barhost", MFD_CLOEXEC);
+    if (shm_fd < 0 || ftruncate(shm_fd, shm_size) < 0) {
+        wavy_log(LOG_ERROR, "Failed to create the bar host buffer");
+        goto fail;
+    }
+    shm = mmap(NULL, shm_size, PROT_READ, MAP_SHARED, shm_fd, 0);
+    if (shm == MAP_FAILED) {
+        shm = NULL;
+        wavy_log(LOG_ERROR, "Failed to map the bar host buffer");
+        goto fail;
+    }
+    event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (event_fd < 0 ||
+        socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        wavy_log(LOG_ERROR, "Failed to create the bar host channels");
+        goto fail;
+    }
+    control_fd = sv[0];
+
+    if (!spawn_host(shm_fd, sv[1])) {
+        wavy_log(LOG_ERROR, "Failed to start wavy-barhost");
+        goto fail;
+    }
+    close(shm_fd);
+    close(sv[1]);
+
+    event_src = wlc_event_loop_add_fd(event_fd, WLC_EVENT_READABLE,
+            event_readable, NULL);
+    control_src = wlc_event_loop_add_fd(control_fd, WLC_EVENT_READABLE,
+            control_readable, NULL);
+    for (uint32_t i = 0; i < num_slots; i++) {
+        slots[i]->host_slot = i;
+    }
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+    wavy_log(LOG_DEBUG, "Running %u widgets in wavy-barhost", num_slots);
+    return;
+
+fail:
+    if (shm_fd >= 0) {
+        close(shm_fd);
+    }
+    if (sv[1] >= 0) {
+        close(sv[1]);
+    }
+    free_barhost();
+}
+
+void free_barhost() {
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    stop_host();
+    if (control_fd >= 0) {
+        close(control_fd);
+        control_fd = -1;
+    }
+    if (event_fd >= 0) {
+        close(event_fd);
+        event_fd = -1;
+    }
+    if (shm) {
+        munmap(shm, shm_size);
+        shm = NULL;
+    }
+    for (uint32_t i = 0; i < num_slots; i++) {
+        slots[i]->host_slot = -1;
+    }
+    free(slots);
+    free(slot_seqs);
+    slots = NULL;
+    slot_seqs = NULL;
+    num_slots = 0;
+}
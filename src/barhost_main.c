@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <cairo/cairo.h>
+#include <pango/pangocairo.h>
+
+#include "luacompat.h"
+#include "barhost.h"
+#include "budget.h"
+#include "bytecode.h"
+#include "utils.h"
+#include "log.h"
+
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+
+/*
+ * wavy-barhost, started by the compositor when 'bar.host' is set (see
+ * barhost.h). It loads the config like a widget worker, then waits for slot
+ * indices on the socket, runs the callbacks of the requested widgets and
+ * draws their strips into the shared buffer.
+ */
+
+bool debug_enabled = false;
+bool wlc_output_enabled = false;
+bool color_log_enabled = true;
+
+int luaopen_libwaveform(lua_State *L);
+
+struct host_slot_t {
+    int32_t ref; // callback in the registry
+    char *text;  // last drawn content
+    uint32_t fg_color;
+    uint32_t bg_color;
+    bool pending;
+    struct budget_t budget;
+};
+
+static lua_State *L = NULL;
+static char *shm = NULL;
+static int event_fd = -1;
+static uint32_t height = 0;
+static uint32_t padding = 0;
+static const char *font = NULL;
+static struct host_slot_t *slots = NULL;
+static uint32_t num_slots = 0;
+static struct budget_limit_t widget_budget = {0};
+
+// there is no event loop to wait on in the host, commands just block
+int async_spawn_read(lua_State *L) {
+    return spawn_read_blocking(L, luaL_checkstring(L, 1));
+}
+
+static bool load_config(const char *file) {
+    L = luaL_newstate();
+    if (!L) {
+        return false;
+    }
+    luaL_openlibs(L);
+
+    // the compositor's module is built in
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+    lua_pushcfunction(L, luaopen_libwaveform);
+    lua_setfield(L, -2, "libwaveform");
+    lua_pop(L, 1);
+    bytecode_preload(L);
+
+    lua_pushcfunction(L, traceback_msghandler);
+    if (bytecode_loadfile(L, file) != LUA_OK ||
+        lua_pcall(L, 0, 0, 1) != LUA_OK) {
+        wavy_log(LOG_ERROR, "%s", lua_tostring(L, -1));
+        return false;
+    }
+    lua_settop(L, 0);
+    return true;
+}
+
+static void resolve_slot(struct host_slot_t *s, uint32_t config_idx) {
+    s->ref = LUA_NOREF;
+    budget_init(&s->budget, widget_budget);
+    if (lua_getglobal(L, "bar") == LUA_TTABLE &&
+        lua_getfield(L, -1, "widgets") == LUA_TTABLE &&
+        lua_geti(L, -1, config_idx) == LUA_TTABLE &&
+        lua_geti(L, -1, 3) == LUA_TFUNCTION) {
+        s->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    lua_settop(L, 0);
+}
+
+// draws a widget into its slot of the shared buffer
+static void draw_slot(uint32_t i, const char *text, uint32_t fg_color,
+        uint32_t bg_color) {
+
+    struct barhost_slot_t *s = (struct barhost_slot_t *)
+        (shm + i * barhost_slot_size(height));
+    unsigned char *pixels = (unsigned char *) (s + 1);
+    int32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32,
+            BARHOST_MAX_WIDTH);
+
+    // odd while writing, the compositor retries a torn read
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint32_t width = 0;
+    if (strlen(text) > 0) {
+        cairo_surface_t *surface = cairo_image_surface_create_for_data(
+                pixels, CAIRO_FORMAT_ARGB32, BARHOST_MAX_WIDTH, height,
+                stride);
+        cairo_t *cr = cairo_create(surface);
+
+        int text_w, text_h;
+        PangoLayout *layout = pango_cairo_create_layout(cr);
+        PangoFontDescription *desc = pango_font_description_from_string(font);
+        pango_layout_set_text(layout, text, -1);
+        pango_layout_set_font_description(layout, desc);
+        pango_font_description_free(desc);
+        pango_layout_get_size(layout, &text_w, &text_h);
+        text_w /= PANGO_SCALE;
+        text_h /= PANGO_SCALE;
+        width = MIN(text_w + 2*(int) padding, BARHOST_MAX_WIDTH);
+
+        // same as widget strips drawn by the compositor
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_rectangle(cr, 0, 0, width, height);
+        cairo_clip(cr);
+        cr_set_argb_color(cr, bg_color);
+        cairo_paint(cr);
+        cr_set_argb_color(cr, fg_color);
+        cairo_move_to(cr, ((int) width - text_w)/2,
+                ((int) height - text_h)/2);
+        pango_cairo_show_layout(cr, layout);
+
+        g_object_unref(layout);
+        cairo_destroy(cr);
+        cairo_surface_flush(surface);
+        cairo_surface_destroy(surface);
+    }
+    s->width = width;
+    s->height = height;
+    s->stride = stride;
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+// runs a widget callback. returns true if its strip was redrawn.
+static bool run_slot(uint32_t i) {
+    struct host_slot_t *s = &slots[i];
+    if (s->ref == LUA_NOREF || !budget_enabled(&s->budget)) {
+        return false;
+    }
+
+    // same budget as a widget running in a worker of the compositor
+    bool changed = false;
+    lua_pushcfunction(L, traceback_msghandler);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, s->ref);
+    budget_start(L, &s->budget);
+    int status = lua_pcall(L, 0, 1, 1);
+    budget_end(L, "Hosted statusbar widget");
+    if (status != LUA_OK) {
+        wavy_log(LOG_ERROR, "Error in statusbar callback function");
+        wavy_log(LOG_ERROR, "%s", lua_tostring(L, -1));
+    } else if (lua_istable(L, -1) &&
+               lua_geti(L, -1, 1) == LUA_TNUMBER &&
+               lua_geti(L, -2, 2) == LUA_TNUMBER &&
+               lua_geti(L, -3, 3) == LUA_TSTRING) {
+
+        const char *text = lua_tostring(L, -1);
+        uint32_t fg_color = lua_tointeger(L, -2);
+        uint32_t bg_color = lua_tointeger(L, -3);
+        if (!s->text || strcmp(s->text, text) ||
+            s->fg_color != fg_color || s->bg_color != bg_color) {
+
+            free(s->text);
+            s->text = strdup(text);
+            s->fg_color = fg_color;
+            s->bg_color = bg_color;
+            draw_slot(i, text, fg_color, bg_color);
+            changed = true;
+        }
+    } else {
+        wavy_log(LOG_ERROR,
+                "Invalid entry in table returned by a statusbar callback");
+    }
+    lua_settop(L, 0);
+    return changed;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 11) {
+        fprintf(stderr, "wavy-barhost is started by wavy, see 'bar.host' in "
+                "the config\n");
+        return EXIT_FAILURE;
+    }
+
+    const char *file = argv[1];
+    int shm_fd = atoi(argv[2]);
+    event_fd = atoi(argv[3]);
+    int control_fd = atoi(argv[4]);
+    height = strtoul(argv[5], NULL, 10);
+    padding = strtoul(argv[6], NULL, 10);
+    font = argv[7];
+    widget_budget.instructions = strtoul(argv[8], NULL, 10);
+    widget_budget.ms = strtoul(argv[9], NULL, 10);
+    budget_cooldown = strtoul(argv[10], NULL, 10);
+    num_slots = argc - 11;
+
+    size_t shm_size = num_slots * barhost_slot_size(height);
+    shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (shm == MAP_FAILED) {
+        wavy_log(LOG_ERROR, "wavy-barhost: failed to map the shared buffer");
+        return EXIT_FAILURE;
+    }
+    close(shm_fd);
+
+    slots = calloc(num_slots, sizeof(struct host_slot_t));
+    if (!slots || !load_config(file)) {
+        wavy_log(LOG_ERROR, "wavy-barhost: failed to load %s", file);
+        return EXIT_FAILURE;
+    }
+    for (uint32_t i = 0; i < num_slots; i++) {
+        resolve_slot(&slots[i], strtoul(argv[11 + i], NULL, 10));
+    }
+
+    // every request is one packet with a slot index. requests that queued
+    // up while a callback ran are run once and signalled together.
+    for (;;) {
+        uint32_t slot;
+        ssize_t n = recv(control_fd, &slot, sizeof(slot), 0);
+        if (n == 0) {
+            break; // the compositor is gone
+        } else if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        do {
+            if (n == sizeof(slot) && slot < num_slots) {
+                slots[slot].pending = true;
+            }
+            n = recv(control_fd, &slot, sizeof(slot), MSG_DONTWAIT);
+        } while (n > 0);
+
+        bool changed = false;
+        for (uint32_t i = 0; i < num_slots; i++) {
+            if (slots[i].pending) {
+                slots[i].pending = false;
+                changed |= run_slot(i);
+            }
+        }
+        if (changed) {
+            uint64_t one = 1;
+            if (write(event_fd, &one, sizeof(one)) < 0) {
+                break;
+            }
+        }
+    }
+
+    lua_close(L);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "luacompat.h"
+#include "budget.h"
+#include "utils.h"
+#include "log.h"
+#ifndef WAVY_BARHOST
+#include "config.h"
+#endif
+
+// instructions between two checks of the budget
+#define BUDGET_STEP 1000
+
+struct budget_run_t {
+    struct budget_t *budget; // NULL if nothing runs under a budget
+    uint64_t count;          // instructions so far
+    int64_t deadline;        // monotonic ms
+    bool exceeded;
+    bool profiling;
+};
+
+// the callback running on this thread
+static __thread struct budget_run_t current;
+
+#ifdef WAVY_BARHOST
+uint32_t budget_cooldown = 30;
+
+// the host doesn't link the profiler
+#define profiler_enabled() false
+#define profiler_sample(L) ((void) (L))
+#define profiler_begin(p) ((void) (p))
+#define profiler_end() ((void) 0)
+
+static uint32_t cooldown() {
+    return budget_cooldown;
+}
+#else
+static uint32_t cooldown() {
+    return config->budget_cooldown;
+}
+#endif
+
+static void budget_hook(lua_State *L, lua_Debug *ar) {
+    (void) ar;
+    struct budget_run_t *r = &current;
+    if (!r->budget) {
+        return;
+    }
+
+    if (r->profiling) {
+        profiler_sample(L);
+    }
+
+    struct budget_limit_t *l = &r->budget->limit;
+    r->count += BUDGET_STEP;
+    if ((l->instructions && r->count > l->instructions) ||
+        (l->ms && monotonic_ms() > r->deadline)) {
+
+        // the hook stays set, so pcall in the callback can't swallow this
+        r->exceeded = true;
+        luaL_error(L, "callback exceeded its budget");
+    }
+}
+
+void budget_init(struct budget_t *b, struct budget_limit_t limit) {
+    b->limit = limit;
+    b->disabled_until = 0;
+    b->overruns = 0;
+    b->profile = NULL;
+    b->transient = false;
+}
+
+bool budget_enabled(struct budget_t *b) {
+    return !b->disabled_until || monotonic_ms() >= b->disabled_until;
+}
+
+void budget_start(lua_State *L, struct budget_t *b) {
+    current.budget = b;
+    current.count = 0;
+    current.deadline = monotonic_ms() + b->limit.ms;
+    current.exceeded = false;
+    current.profiling = b->profile && profiler_enabled();
+    if (current.profiling) {
+        profiler_begin(b->profile);
+    }
+    if (b->limit.instructions || b->limit.ms || current.profiling) {
+        lua_sethook(L, budget_hook, LUA_MASKCOUNT, BUDGET_STEP);
+    }
+}
+
+bool budget_end(lua_State *L, const char *name) {
+    struct budget_t *b = current.budget;
+    lua_sethook(L, NULL, 0, 0);
+    if (current.profiling) {
+        profiler_end();
+    }
+    current.budget = NULL;
+    if (!b || !current.exceeded) {
+        return false;
+    }
+
+    if (b->transient) {
+        wavy_log(LOG_ERROR, "%s exceeded its budget (%u instructions, %u ms)",
+                name, b->limit.instructions, b->limit.ms);
+        return true;
+    }
+
+    b->overruns++;
+    b->disabled_until = monotonic_ms() + cooldown() * 1000;
+    wavy_log(LOG_ERROR, "%s exceeded its budget (%u instructions, %u ms), "
+            "disabled for %u s (overrun %u)", name, b->limit.instructions,
+            b->limit.ms, cooldown(), b->overruns);
+    return true;
+}
@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "luacompat.h"
+#include "bytecode.h"
+#include "log.h"
+
+// generated by CMake from config/wavy_utils.lua
+#include "wavy_utils_chunk.h"
+
+#define BYTECODE_MAGIC "WAVYLUAC"
+
+struct bytecode_header_t {
+    char magic[8];
+    uint32_t version;   // LUA_VERSION_NUM of the dump
+    uint32_t reserved;
+    int64_t mtime_sec;  // of the source
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint64_t hash;      // FNV-1a of the source
+};
+
+struct dump_buffer_t {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+static uint64_t fnv1a(const char *data, size_t len) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) data[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    char *data = NULL;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long size = ftell(f);
+        rewind(f);
+        if (size >= 0 && (data = malloc(size + 1))) {
+            *len = fread(data, 1, size, f);
+            data[*len] = 0;
+        }
+    }
+    fclose(f);
+    return data;
+}
+
+static int dump_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+    (void) L;
+    struct dump_buffer_t *b = ud;
+    if (b->len + sz > b->size) {
+        size_t size = b->size ? b->size * 2 : 4096;
+        while (size < b->len + sz) {
+            size *= 2;
+        }
+        char *data = realloc(b->data, size);
+        if (!data) {
+            return 1;
+        }
+        b->data = data;
+        b->size = size;
+    }
+    memcpy(b->data + b->len, p, sz);
+    b->len += sz;
+    return 0;
+}
+
+// writes the cache through a temporary file, so concurrent loads (e.g. by
+// the widget workers) never see a partial one
+static void write_cache(const char *cache, struct bytecode_header_t *h,
+        const char *dump, size_t len) {
+
+    size_t tmp_len = strlen(cache) + 8;
+    char *tmp = malloc(tmp_len);
+    if (!tmp) {
+        return;
+    }
+    snprintf(tmp, tmp_len, "%s.XXXXXX", cache);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        wavy_log(LOG_DEBUG, "Can't write bytecode cache %s", cache);
+        free(tmp);
+        return;
+    }
+
+    bool ok = write(fd, h, sizeof(*h)) == sizeof(*h) &&
+              write(fd, dump, len) == (ssize_t) len;
+    close(fd);
+    if (!ok || rename(tmp, cache) < 0) {
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+static bool load_dump(lua_State *L, const char *file, const char *data,
+        size_t len) {
+
+    char name[4096];
+    snprintf(name, sizeof(name), "@%s", file);
+    if (luaL_loadbufferx(L, data, len, name, "b") == LUA_OK) {
+        return true;
+    }
+    lua_pop(L, 1);
+    return false;
+}
+
+int bytecode_loadfile(lua_State *L, const char *file) {
+    struct stat st;
+    if (stat(file, &st) < 0) {
+        return luaL_loadfile(L, file); // for the error message
+    }
+
+    char cache[4096];
+    size_t file_len = strlen(file);
+    if (file_len > 4 && !strcmp(file + file_len - 4, ".lua")) {
+        snprintf(cache, sizeof(cache), "%sc", file);
+    } else {
+        snprintf(cache, sizeof(cache), "%s.luac", file);
+    }
+
+    struct bytecode_header_t h = {
+        .version = LUA_VERSION_NUM,
+        .mtime_sec = st.st_mtim.tv_sec,
+        .mtime_nsec = st.st_mtim.tv_nsec,
+        .size = st.st_size,
+    };
+    memcpy(h.magic, BYTECODE_MAGIC, sizeof(h.magic));
+
+    // unchanged since the cache was written
+    size_t cache_len = 0;
+    char *cached = read_file(cache, &cache_len);
+    struct bytecode_header_t *ch = (struct bytecode_header_t *) cached;
+    bool usable = cached && cache_len > sizeof(h) &&
+        !memcmp(ch->magic, h.magic, sizeof(h.magic)) &&
+        ch->version == h.version && ch->size == h.size;
+    if (usable && ch->mtime_sec == h.mtime_sec &&
+        ch->mtime_nsec == h.mtime_nsec &&
+        load_dump(L, file, cached + sizeof(h), cache_len - sizeof(h))) {
+        free(cached);
+        return LUA_OK;
+    }
+
+    size_t len = 0;
+    char *src = read_file(file, &len);
+    if (!src) {
+        free(cached);
+        return luaL_loadfile(L, file);
+    }
+    h.hash = fnv1a(src, len);
+
+    // only touched, the cache gets the new mtime
+    if (usable && ch->hash == h.hash &&
+        load_dump(L, file, cached + sizeof(h), cache_len - sizeof(h))) {
+        write_cache(cache, &h, cached + sizeof(h), cache_len - sizeof(h));
+        free(cached);
+        free(src);
+        return LUA_OK;
+    }
+    free(cached);
+
+    // skip a '#' line like luaL_loadfile does, keeping the line numbers
+    const char *code = src;
+    if (code[0] == '#') {
+        while (*code && *code != '\n') {
+            code++;
+        }
+    }
+
+    char name[4096];
+    snprintf(name, sizeof(name), "@%s", file);
+    int status = luaL_loadbufferx(L, code, len - (code - src), name, "t");
+    free(src);
+    if (status != LUA_OK) {
+        return status;
+    }
+
+    struct dump_buffer_t b = {NULL, 0, 0};
+    if (lua_dump(L, dump_writer, &b, 0) == 0) {
+        write_cache(cache, &h, b.data, b.len);
+    }
+    free(b.data);
+    return LUA_OK;
+}
+
+// depth limits the upvalues that are followed, recursive functions have
+// themselves as an upvalue
+static uint64_t hash_value(lua_State *L, int idx, uint32_t depth) {
+    idx = lua_absindex(L, idx);
+    switch (lua_type(L, idx)) {
+    case LUA_TSTRING: {
+        size_t len;
+        const char *str = lua_tolstring(L, idx, &len);
+        return fnv1a(str, len);
+    }
+    case LUA_TNUMBER:
+        if (lua_isinteger(L, idx)) {
+            lua_Integer n = lua_tointeger(L, idx);
+            return fnv1a((const char *) &n, sizeof(n));
+        } else {
+            lua_Number n = lua_tonumber(L, idx);
+            return fnv1a((const char *) &n, sizeof(n)) + 1;
+        }
+    case LUA_TBOOLEAN:
+        return lua_toboolean(L, idx) ? 2 : 1;
+    case LUA_TFUNCTION:
+        if (!lua_iscfunction(L, idx)) {
+            break;
+        }
+        // fall through
+    default:
+        return 0;
+    }
+
+    uint64_t h = 0;
+    struct dump_buffer_t b = {NULL, 0, 0};
+    lua_pushvalue(L, idx);
+    if (lua_dump(L, dump_writer, &b, 1) == 0) {
+        h = fnv1a(b.data, b.len);
+    }
+    free(b.data);
+    lua_pop(L, 1);
+
+    for (int i = 1; depth > 0 && lua_getupvalue(L, idx, i); i++) {
+        if (!lua_rawequal(L, -1, idx)) {
+            h = h * 31 + hash_value(L, -1, depth - 1);
+        }
+        lua_pop(L, 1);
+    }
+    return h;
+}
+
+uint64_t bytecode_hash(lua_State *L, int idx) {
+    return hash_value(L, idx, 4);
+}
+
+static int load_wavy_utils(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+
+    // package.searchpath(name, package.path)
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "searchpath");
+    lua_pushstring(L, name);
+    lua_getfield(L, -3, "path");
+    lua_call(L, 2, 1);
+
+    int status;
+    if (lua_isstring(L, -1)) {
+        status = bytecode_loadfile(L, lua_tostring(L, -1));
+    } else {
+        status = luaL_loadbufferx(L, (const char *) wavy_utils_chunk,
+                wavy_utils_chunk_size, "=wavy_utils", NULL);
+    }
+    if (status != LUA_OK) {
+        return lua_error(L);
+    }
+
+    lua_pushstring(L, name);
+    lua_call(L, 1, 1);
+    return 1;
+}
+
+void bytecode_preload(lua_State *L) {
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+    lua_pushcfunction(L, load_wavy_utils);
+    lua_setfield(L, -2, "wavy_utils");
+    lua_pop(L, 1);
+}
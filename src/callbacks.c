@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <wlc/wlc.h>
@@ -14,6 +15,22 @@
 #include "wallpaper.h"
 #include "input.h"
 #include "config.h"
+#include "vector.h"
+#include "events.h"
+#include "scheduler.h"
+
+// rate limiting of property updates, so a view that changes its title all
+// the time can't keep the widgets busy
+struct view_rate_t {
+    wlc_handle view;
+    int64_t last_ms;                    // last time the update went through
+    struct wlc_event_source *timer;     // trailing update
+    bool armed;
+    bool title;                         // the trailing update has a title
+};
+
+// *view_rate_t's
+static struct vector_t *view_rates = NULL;
 
 // "key" is a keycode. We use keysyms internally for keybindings for now, but
 // will (hopefully) support keybindings with keycodes as well in the future.
@@ -59,7 +76,10 @@ static bool view_created(wlc_handle view) {
 
     // regular view thats goes into tiling mode
     case 0:
-        return child_add(view);
+        if (!child_add(view)) {
+            return false;
+        }
+        break;
 
     // these views don't get focus
     case WLC_BIT_SPLASH:
@@ -81,10 +101,67 @@ static bool view_created(wlc_handle view) {
         break;
     }
 
+    event_emit(EVENT_VIEW_CREATED, view, wlc_view_get_output(view), 0);
     return true;
 }
 
+static void view_rate_free(void *data) {
+    struct view_rate_t *r = data;
+    if (r->timer) {
+        wlc_event_source_remove(r->timer);
+    }
+    free(r);
+}
+
+static void view_rate_remove(wlc_handle view) {
+    for (uint32_t i = 0; view_rates && i < view_rates->length; i++) {
+        struct view_rate_t *r = view_rates->items[i];
+        if (r->view == view) {
+            view_rate_free(r);
+            vector_del(view_rates, i);
+            return;
+        }
+    }
+}
+
+static struct view_rate_t *view_rate_get(wlc_handle view) {
+    if (!view_rates) {
+        view_rates = vector_init();
+    }
+    for (uint32_t i = 0; i < view_rates->length; i++) {
+        struct view_rate_t *r = view_rates->items[i];
+        if (r->view == view) {
+            return r;
+        }
+    }
+
+    struct view_rate_t *r = calloc(1, sizeof(struct view_rate_t));
+    if (!r) {
+        return NULL;
+    }
+    r->view = view;
+    r->last_ms = monotonic_ms() - config->view_update_interval;
+    vector_add(view_rates, r);
+    return r;
+}
+
+// fires at the end of a throttled interval, so the last title is shown
+static int view_rate_flush(void *arg) {
+    struct view_rate_t *r = arg;
+    r->armed = false;
+    r->last_ms = monotonic_ms();
+    wlc_handle output = wlc_view_get_output(r->view);
+    if (r->title) {
+        r->title = false;
+        event_emit(EVENT_TITLE_CHANGED, r->view, output, 0);
+    }
+    hook_request(HOOK_VIEW_UPDATE, output);
+    return 0;
+}
+
 static void view_destroyed(wlc_handle view) {
+    event_emit(EVENT_VIEW_DESTROYED, view, wlc_view_get_output(view), 0);
+    view_rate_remove(view);
     if (wlc_view_get_type(view) == 0) {
         child_delete(view);
     } else {
@@ -93,13 +170,49 @@ static void view_destroyed(wlc_handle view) {
     }
 }
 
+// title_changed events are rate limited like the hook
 static void view_properties_updated(wlc_handle view, uint32_t mask) {
-    (void) mask; (void) view;
-    trigger_hook(HOOK_VIEW_UPDATE);
+    bool title = mask & WLC_BIT_PROPERTY_TITLE;
+    wlc_handle output = wlc_view_get_output(view);
+    struct view_rate_t *r;
+    if (config->view_update_interval == 0 || !(r = view_rate_get(view))) {
+        if (title) {
+            event_emit(EVENT_TITLE_CHANGED, view, output, 0);
+        }
+        hook_request(HOOK_VIEW_UPDATE, output);
+        return;
+    }
+
+    // a trailing update is already on its way
+    if (r->armed) {
+        r->title |= title;
+        return;
+    }
+
+    int64_t now = monotonic_ms();
+    int64_t wait = r->last_ms + config->view_update_interval - now;
+    if (wait <= 0) {
+        r->last_ms = now;
+        if (title) {
+            event_emit(EVENT_TITLE_CHANGED, view, output, 0);
+        }
+        hook_request(HOOK_VIEW_UPDATE, output);
+        return;
+    }
+
+    if (!r->timer) {
+        r->timer = wlc_event_loop_add_timer(view_rate_flush, r);
+    }
+    if (r->timer) {
+        wlc_event_source_timer_update(r->timer, wait);
+        r->armed = true;
+        r->title = title;
+    }
 }
 
 static bool output_created(wlc_handle output) {
     add_output(output);
+    event_emit(EVENT_OUTPUT_ADDED, 0, output, 0);
     return true;
 }
 
@@ -124,11 +237,10 @@ static bool pointer_motion(wlc_handle view, uint32_t time,
     return false;
 }
 
-// does nothing
 static void view_focus(wlc_handle view, bool focus) {
-    (void) view;
-    (void) focus;
-	return;
+    if (focus) {
+        layout_view_focused(view);
+    }
 }
 
 static bool pointer_button(wlc_handle view, uint32_t time,
@@ -175,6 +287,8 @@ static void output_render_pre(wlc_handle output) {
     }
 
     render_frame_borders(out->active_ws->root_frame);
+    scheduler_wake();
+    hook_flush();
     render_bar(out);
 }
 
@@ -220,3 +334,11 @@ void set_wlc_callbacks() {
     wlc_set_input_created_cb(input_created);
     wlc_set_input_destroyed_cb(input_destroyed);
 }
+
+void free_callbacks() {
+    if (view_rates) {
+        vector_foreach(view_rates, view_rate_free);
+        vector_free(view_rates);
+        view_rates = NULL;
+    }
+}
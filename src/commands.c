@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <wlc/wlc.h>
 
 #include "vector.h"
@@ -9,6 +10,10 @@
 #include "layout.h"
 #include "log.h"
 #include "utils.h"
+#include "async.h"
+#include "budget.h"
+#include "profiler.h"
+#include "luamem.h"
 
 /*
  * A *_cmd function will be called (via a pointer to it in the keybind_t struct)
@@ -35,17 +40,76 @@ void spawn_cmd(struct keybind_t *kb, wlc_handle view) {
     cmd_exec(str_arr[0], str_arr);
 }
 
+// must be called with lua_lock held
+static void lua_cmd_step(lua_State *L, lua_State *co, int status) {
+    luamem_collect(L);
+    if (status == LUA_YIELD) {
+        return; // waiting for a command, see lua_cmd_resume
+    }
+    if (status != LUA_OK) {
+        wavy_log(LOG_ERROR, "Error %d occured in lua keybinding function",
+                status);
+    }
+    async_thread_free(L, co);
+}
+
+// owner is the lua_State of the config the binding was started in. after a
+// reload that is an old one, which is closed once its last binding is done.
+// the binding isn't known here, the rest of it runs under the default budget
+// without disabling anything.
+void lua_cmd_resume(void *owner, lua_State *co, char *output) {
+    lua_State *L = owner;
+    struct budget_t budget;
+    budget_init(&budget, config->budgets[BUDGET_KEYBINDING]);
+    budget.transient = true;
+
+    pthread_mutex_lock(&lua_lock);
+    enum luamem_subsys_t prev = luamem_set_subsys(L, LUAMEM_KEYBINDINGS);
+    lua_pushstring(co, output ? output : "");
+    budget_start(co, &budget);
+    int status = async_resume(co, 1);
+    budget_end(co, "Lua keybinding");
+    lua_cmd_step(L, co, status);
+    luamem_set_subsys(L, prev);
+    if (L != L_config && !async_threads_pending(L)) {
+        luamem_close(L);
+    }
+    pthread_mutex_unlock(&lua_lock);
+    free(output);
+}
+
+// the binding runs in a coroutine, so it can wait for commands started with
+// spawn_read without blocking the compositor or holding lua_lock. it runs
+// under a budget, so a runaway binding can't freeze the compositor.
 void lua_cmd(struct keybind_t *kb, wlc_handle view) {
     (void) view;
+    if (!budget_enabled(&kb->budget)) {
+        wavy_log(LOG_DEBUG, "Lua keybinding is disabled after an overrun");
+        return;
+    }
+
     pthread_mutex_lock(&lua_lock);
     lua_rawgeti(L_config, LUA_REGISTRYINDEX, kb->args.num);
-    int err;
-    if ((err = lua_pcall(L_config, 0, 0, 0)) != LUA_OK) {
-        wavy_log(LOG_ERROR, "Error %d occured in lua keybinding function", err);
+    if (!kb->budget.profile && profiler_enabled()) {
+        kb->budget.profile = profiler_get("keybinding", kb->args.num,
+                L_config, kb->args.num);
     }
+    enum luamem_subsys_t prev = luamem_set_subsys(L_config,
+            LUAMEM_KEYBINDINGS);
+    lua_State *co = async_thread_new(L_config);
+    budget_start(co, &kb->budget);
+    int status = async_resume(co, 0);
+    budget_end(co, "Lua keybinding");
+    lua_cmd_step(L_config, co, status);
+    luamem_set_subsys(L_config, prev);
     pthread_mutex_unlock(&lua_lock);
 }
 
+void reload_cmd(struct keybind_t *kb, wlc_handle view) {
+    (void) view; (void) kb;
+    config_reload();
+}
+
 void cycle_tiling_mode_cmd(struct keybind_t *kb, wlc_handle view) {
     (void) view; (void) kb;
     wavy_log(LOG_DEBUG, "Cycling tiling mode");
@@ -107,24 +171,91 @@ void init_commands() {
     commands = vector_init();
 }
 
-void free_commands() {
-    for (uint32_t i = 0; i < commands->length; i++) {
-        struct keybind_t *kb = commands->items[i];
-        free(kb);
+// spawn bindings own their NULL terminated argument list
+static void free_args(struct keybind_t *kb) {
+    if (kb->keybind_f != spawn_cmd || !kb->args.ptr) {
+        return;
+    }
+    for (char **arg = (char **) kb->args.ptr; *arg; arg++) {
+        free(*arg);
     }
+    free(kb->args.ptr);
+}
+
+void keybind_free(void *data) {
+    struct keybind_t *kb = data;
+    free_args(kb);
+    free(kb);
+}
 
+void free_commands() {
+    vector_foreach(commands, keybind_free);
     vector_free(commands);
 }
 
-void cmd_update(uint32_t mods, uint32_t keysym, struct keybind_arg_t args,
+// lua bindings are compared by their code, the registry references of two
+// config states have nothing in common
+static bool keybind_equal(struct keybind_t *a, struct keybind_t *b) {
+    if (a->keysym != b->keysym || a->mods != b->mods ||
+        a->keybind_f != b->keybind_f) {
+        return false;
+    }
+    if (a->keybind_f == lua_cmd) {
+        return a->args.code_hash == b->args.code_hash;
+    }
+    if (a->keybind_f == spawn_cmd) {
+        char **arg_a = (char **) a->args.ptr;
+        char **arg_b = (char **) b->args.ptr;
+        for (; *arg_a && *arg_b; arg_a++, arg_b++) {
+            if (strcmp(*arg_a, *arg_b)) {
+                return false;
+            }
+        }
+        return !*arg_a && !*arg_b;
+    }
+    return a->args.dir == b->args.dir && a->args.num == b->args.num &&
+           a->args.f == b->args.f;
+}
+
+uint32_t cmd_replace(struct vector_t *cmds) {
+    uint32_t unchanged = 0;
+    for (uint32_t i = 0; i < cmds->length; i++) {
+        struct keybind_t *kb = cmds->items[i];
+        for (uint32_t j = 0; j < commands->length; j++) {
+            struct keybind_t *old = commands->items[j];
+            if (keybind_equal(old, kb)) {
+                // a binding that was disabled after an overrun stays so.
+                // the profile belongs to the old state's registry.
+                kb->budget.disabled_until = old->budget.disabled_until;
+                kb->budget.overruns = old->budget.overruns;
+                unchanged++;
+                break;
+            }
+        }
+        kb->budget.limit = config->budgets[BUDGET_KEYBINDING];
+    }
+
+    free_commands();
+    commands = cmds;
+    return unchanged;
+}
+
+void cmd_update(struct vector_t *cmds, uint32_t mods, uint32_t keysym,
+        struct keybind_arg_t args,
         void (*keybind_f) (struct keybind_t * args, wlc_handle view)) {
 
+    // cmds belongs to a config that is still being read, cmd_replace sets
+    // the limits of that config once it is live
+    struct budget_limit_t no_limit = {0};
+
     // if the keysym/mods combination is already bound, we update it
-    for (uint32_t i = 0; i < commands->length; i++) {
-        struct keybind_t *kb_i =  (struct keybind_t *) (commands->items[i]);
+    for (uint32_t i = 0; i < cmds->length; i++) {
+        struct keybind_t *kb_i =  (struct keybind_t *) (cmds->items[i]);
         if (kb_i->keysym == keysym && kb_i->mods == mods) {
+            free_args(kb_i);
             kb_i->args = args;
             kb_i->keybind_f = keybind_f;
+            budget_init(&kb_i->budget, no_limit);
             return;
         }
     }
@@ -139,7 +270,8 @@ void cmd_update(uint32_t mods, uint32_t keysym, struct keybind_arg_t args,
     new_kb->mods = mods;
     new_kb->args = args;
     new_kb->keybind_f = keybind_f;
-    vector_add(commands, new_kb);
+    budget_init(&new_kb->budget, no_limit);
+    vector_add(cmds, new_kb);
 }
 
 bool eval_keypress(wlc_handle view, uint32_t mods, uint32_t keysym) {
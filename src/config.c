@@ -4,20 +4,28 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <wordexp.h>
-#include <lua.h>
-#include <lualib.h>
-#include <lauxlib.h>
 #include <wlc/wlc.h>
 #include <pthread.h>
 #include <libinput.h>
 #include <xkbcommon/xkbcommon.h>
 
+#include "luacompat.h"
 #include "commands.h"
 #include "config.h"
 #include "log.h"
 #include "bar.h"
 #include "utils.h"
 #include "input.h"
+#include "sources.h"
+#include "async.h"
+#include "profiler.h"
+#include "bytecode.h"
+#include "layout.h"
+#include "loop.h"
+#include "workers.h"
+#include "scheduler.h"
+#include "barhost.h"
+#include "events.h"
 
 // global config pointer
 struct wavy_config_t *config = NULL;
@@ -30,7 +38,27 @@ lua_State *L_config = NULL;
 // which takes the lock again.
 pthread_mutex_t lua_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
-static void default_config() {
+// a config file that was run in a new lua_State and read into new
+// structures. init_config applies it right away, a reload compares it with
+// the live config first.
+struct config_load_t {
+    lua_State *L;
+    struct wavy_config_t *config;
+    struct vector_t *keybindings; // *keybind_t's
+    struct vector_t *widgets;     // *status_entry_t's
+    uint64_t globals_hash;        // of the global lua functions
+};
+
+// globals_hash of the running widgets (main loop only)
+static uint64_t live_globals_hash = 0;
+
+// strings of replaced configs. the render and widget threads might still
+// read them, they are freed on exit.
+static struct vector_t *retired = NULL;
+
+static bool reloading = false; // atomic
+
+static void default_config(struct wavy_config_t *config) {
     config->frame_gaps_size                     = 5;
     config->frame_border_size                   = 0;
     config->frame_border_empty_size             = 3;
@@ -42,9 +70,18 @@ static void default_config() {
     config->view_border_size                    = 2;
     config->view_border_active_color            = 0x4897cfff;
     config->view_border_inactive_color          = 0x475b74ff;
+    config->view_update_interval                = 100;
+
+    config->budgets[BUDGET_WIDGET].instructions = 10000000;
+    config->budgets[BUDGET_WIDGET].ms           = 500;
+    config->budgets[BUDGET_KEYBINDING].instructions = 5000000;
+    config->budgets[BUDGET_KEYBINDING].ms       = 100;
+    config->budget_cooldown                     = 30;
+    config->profiler_interval                   = 60;
+    config->lua_memory_limit                    = 32768;
 
     config->statusbar_height                    = 17;
-    config->statusbar_font                      = "monospace 10";
+    config->statusbar_font                      = strdup("monospace 10");
     config->statusbar_gap                       = 4;
     config->statusbar_padding                   = 10;
     config->statusbar_position                  = POS_TOP;
@@ -56,6 +93,9 @@ static void default_config() {
     config->statusbar_separator_enabled         = false;
     config->statusbar_separator_color           = 0x2d95efff;
     config->statusbar_separator_width           = 1;
+    config->statusbar_workers                   = 2;
+    config->statusbar_glyph_atlas               = false;
+    config->statusbar_host                      = false;
 
     for (uint32_t i = 0; i < 5; i++) {
         config->tile_layouts[i] = i;
@@ -68,9 +108,8 @@ static void check_argc(lua_State *L, uint32_t argc, uint32_t argc_expected,
 
     if (argc_expected != argc) {
         luaL_error(L, "Wrong number of arguments for a \'%s\' keybinding: "
-                      "expected %I, got %I",
-                      func_name, (lua_Integer) argc_expected,
-                      (lua_Integer) argc);
+                      "expected %d, got %d",
+                      func_name, (int) argc_expected, (int) argc);
     }
 }
 
@@ -178,7 +217,9 @@ static uint32_t get_num(lua_State *L, int32_t idx_table, int32_t idx) {
 }
 
 // idx: positive index of subtable of 'keys' table
-static void keybind_string_filter(lua_State *L, int32_t idx) {
+static void keybind_string_filter(lua_State *L, int32_t idx,
+        struct vector_t *cmds) {
+
     uint32_t argc = lua_rawlen(L, idx);
     if (lua_geti(L, idx, 1) != LUA_TSTRING) {
         luaL_error(L, "Invalid keybinding type: must be string, got %s",
@@ -186,7 +227,7 @@ static void keybind_string_filter(lua_State *L, int32_t idx) {
     }
     const char *kb_str = lua_tostring(L, -1);
 
-    struct keybind_arg_t kb_null = {0, 0, 0, 0, 0};
+    struct keybind_arg_t kb_null = {0};
 
     if (!strcmp(kb_str, "spawn")) {
         check_argc(L, argc, 4, "spawn");
@@ -195,23 +236,32 @@ static void keybind_string_filter(lua_State *L, int32_t idx) {
                           "got %s", lua_typename(L, lua_type(L, -1)));
         }
         struct keybind_arg_t kba = {.ptr = (void **) table_to_str_array(L, -1)};
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kba, spawn_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kba, spawn_cmd);
         lua_pop(L, 1);
     } else if (!strcmp(kb_str, "lua")) {
         check_argc(L, argc, 4, "lua");
+        lua_geti(L, idx, 4);
+        uint64_t code_hash = bytecode_hash(L, -1);
+        lua_pop(L, 1);
         struct keybind_arg_t kba = {
-            .num = reg_lua_function(L, idx, 4)
+            .num = reg_lua_function(L, idx, 4),
+            .code_hash = code_hash
         };
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kba, lua_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kba, lua_cmd);
+    } else if (!strcmp(kb_str, "reload")) {
+        check_argc(L, argc, 3, "reload");
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kb_null,
+                reload_cmd);
     } else if (!strcmp(kb_str, "exit")) {
         check_argc(L, argc, 3, "exit");
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kb_null, exit_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kb_null, exit_cmd);
     } else if (!strcmp(kb_str, "close_view")) {
         check_argc(L, argc, 3, "close_view");
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kb_null, close_view_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kb_null,
+                close_view_cmd);
     } else if (!strcmp(kb_str, "cycle_tiling_mode")) {
         check_argc(L, argc, 3, "cycle_tiling_mode");
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kb_null,
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kb_null,
                 cycle_tiling_mode_cmd);
     } else if (!strcmp(kb_str, "cycle_view")) {
         check_argc(L, argc, 4, "cycle_view");
@@ -224,16 +274,16 @@ static void keybind_string_filter(lua_State *L, int32_t idx) {
         struct keybind_arg_t kba = {
             .num = strcmp(next_bkwd, "previous") ? 1 : 0
         };
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kba, cycle_view_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kba, cycle_view_cmd);
         lua_pop(L, 1);
     } else if (!strcmp(kb_str, "select")) {
         check_argc(L, argc, 4, "select");
         struct keybind_arg_t kba = {.dir = get_dir(L, idx, 4)};
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kba, select_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kba, select_cmd);
     } else if (!strcmp(kb_str, "move")) {
         check_argc(L, argc, 4, "move");
         struct keybind_arg_t kba = {.dir = get_dir(L, idx, 4)};
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kba, move_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kba, move_cmd);
     } else if (!strcmp(kb_str, "new_frame")) {
         check_argc(L, argc, 4, "new_frame");
         if (lua_geti(L, idx, 4) != LUA_TSTRING) {
@@ -244,18 +294,19 @@ static void keybind_string_filter(lua_State *L, int32_t idx) {
         struct keybind_arg_t kba = {
             .dir = strcmp(d, "right") ? DIR_LEFT : DIR_RIGHT
         };
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kba, new_frame_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kba, new_frame_cmd);
         lua_pop(L, 1);
     } else if (!strcmp(kb_str, "delete_frame")) {
         check_argc(L, argc, 3, "delete_frame");
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kb_null, delete_frame_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kb_null,
+                delete_frame_cmd);
     } else if (!strcmp(kb_str, "resize")) {
         check_argc(L, argc, 5, "resize");
         struct keybind_arg_t kba = {
             .dir = get_dir(L, idx, 4),
             .f = get_float(L, idx, 5)
         };
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kba, resize_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kba, resize_cmd);
     } else if (!strcmp(kb_str, "cycle_workspace")) {
         check_argc(L, argc, 4, "cycle_workspace");
         if (lua_geti(L, idx, 4) != LUA_TSTRING) {
@@ -266,19 +317,21 @@ static void keybind_string_filter(lua_State *L, int32_t idx) {
         struct keybind_arg_t kba = {
             .num = strcmp(next_bkwd, "previous") ? 1 : 0
         };
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kba, cycle_workspace_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kba,
+                cycle_workspace_cmd);
         lua_pop(L, 1);
     } else if (!strcmp(kb_str, "add_workspace")) {
         check_argc(L, argc, 3, "add_workspace");
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kb_null, add_ws_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kb_null, add_ws_cmd);
     } else if (!strcmp(kb_str, "select_workspace")) {
         check_argc(L, argc, 4, "select_workspace");
         struct keybind_arg_t kba = {.num = get_num(L, idx, 4)};
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kba, switch_workspace_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kba,
+                switch_workspace_cmd);
     } else if (!strcmp(kb_str, "move_to_workspace")) {
         check_argc(L, argc, 4, "move_to_workspace");
         struct keybind_arg_t kba = {.num = get_num(L, idx, 4)};
-        cmd_update(get_mod(L, idx), get_sym(L, idx), kba, move_to_ws_cmd);
+        cmd_update(cmds, get_mod(L, idx), get_sym(L, idx), kba, move_to_ws_cmd);
     } else {
         luaL_error(L, "Unknown keybinding type: \'%s\'", kb_str);
     }
@@ -286,7 +339,7 @@ static void keybind_string_filter(lua_State *L, int32_t idx) {
     lua_pop(L, 1);
 }
 
-static void keybind_config(lua_State *L) {
+static void keybind_config(lua_State *L, struct vector_t *cmds) {
     if (lua_getglobal(L, "keys") != LUA_TTABLE) {
         wavy_log(LOG_WAVY, "Warning: no keybindings specified!");
         return;
@@ -298,7 +351,7 @@ static void keybind_config(lua_State *L) {
         if (lua_geti(L, keys, idx) != LUA_TTABLE) {
             luaL_error(L, "Invalid entry in \'keys\' table, must be table");
         }
-        keybind_string_filter(L, lua_gettop(L));
+        keybind_string_filter(L, lua_gettop(L), cmds);
         lua_pop(L, 1);
     }
     lua_settop(L, 0);
@@ -317,6 +370,7 @@ static void set_conf_str(lua_State *L, const char *name, char **conf,
         int32_t idx) {
 
     if (lua_getfield(L, idx, name) == LUA_TSTRING) {
+        free(*conf);
         *conf = strdup(lua_tostring(L, -1));
     }
     lua_pop(L, 1);
@@ -331,12 +385,26 @@ static void set_conf_bool(lua_State *L, const char *name, bool *conf,
     lua_pop(L, 1);
 }
 
-static void set_layouts(lua_State *L) {
+// a table {instructions = n, ms = n}
+static void set_conf_budget(lua_State *L, const char *name,
+        struct budget_limit_t *limit, int32_t idx) {
+
+    if (lua_getfield(L, idx, name) == LUA_TTABLE) {
+        set_conf_int(L, "instructions", &limit->instructions, -1);
+        set_conf_int(L, "ms", &limit->ms, -1);
+    }
+    lua_pop(L, 1);
+}
+
+static void set_layouts(lua_State *L, struct wavy_config_t *config) {
     if (lua_getglobal(L, "layouts") != LUA_TTABLE) {
         lua_settop(L, 0);
         return;
     }
     config->num_layouts = lua_rawlen(L, -1);
+    if (config->num_layouts == 0 || config->num_layouts > 5) {
+        luaL_error(L, "The layouts table needs 1 to 5 entries");
+    }
     for (uint32_t i = 0; i < config->num_layouts; i++) {
         if (lua_geti(L, -1, i+1) == LUA_TTABLE &&
             lua_geti(L, -1, 1) == LUA_TSTRING &&
@@ -349,6 +417,9 @@ static void set_layouts(lua_State *L) {
             // store the tiling mode
             const char *str = lua_tostring(L, -2);
             config->tile_layouts[i] = tiling_layout_str_to_enum(str);
+            if (config->tile_layouts[i] == TILE_UNKNOWN) {
+                luaL_error(L, "Invalid tiling layout: %s", str);
+            }
             lua_pop(L, 3);
         } else {
             luaL_error(L, "Invalid entry in layouts subtable");
@@ -357,7 +428,7 @@ static void set_layouts(lua_State *L) {
     lua_settop(L, 0);
 }
 
-static void set_autostart(lua_State *L) {
+static void set_autostart(lua_State *L, struct wavy_config_t *config) {
     if (lua_getglobal(L, "autostart") != LUA_TTABLE) {
         lua_settop(L, 0);
         return;
@@ -398,7 +469,9 @@ static enum side_t side_str_to_enum(const char *str) {
     return s;
 }
 
-static void bar_config(lua_State *L) {
+static void bar_config(lua_State *L, struct wavy_config_t *config,
+        struct vector_t *widgets_out) {
+
     if (lua_getglobal(L, "bar") != LUA_TTABLE) {
         lua_settop(L, 0);
         return;
@@ -415,6 +488,14 @@ static void bar_config(lua_State *L) {
             bar_idx);
     set_conf_int(L, "separator_width", &config->statusbar_separator_width,
             bar_idx);
+    set_conf_int(L, "workers", &config->statusbar_workers, bar_idx);
+    if (config->statusbar_workers == 0) {
+        // the widgets would be queued and never run
+        wavy_log(LOG_ERROR, "The statusbar needs at least 1 worker, using 1");
+        config->statusbar_workers = 1;
+    }
+    set_conf_bool(L, "glyph_atlas", &config->statusbar_glyph_atlas, bar_idx);
+    set_conf_bool(L, "host", &config->statusbar_host, bar_idx);
 
     if (lua_getfield(L, bar_idx, "position") == LUA_TSTRING) {
         enum position_t p = pos_str_to_enum(lua_tostring(L, -1));
@@ -442,15 +523,19 @@ static void bar_config(lua_State *L) {
         uint32_t len = lua_rawlen(L, widgets);
         for (uint32_t i = 0; i < len; i++) {
             if (lua_geti(L, widgets, i+1) == LUA_TTABLE) {
+                int32_t widget = lua_gettop(L);
                 int ref;
                 enum hook_t hook;
                 enum side_t side;
+                uint32_t interval_ms = 0;
+                bool align = false;
 
                 if (lua_geti(L, -1, 1) == LUA_TSTRING &&
                     lua_geti(L, -2, 2) == LUA_TSTRING &&
                     lua_geti(L, -3, 3) == LUA_TFUNCTION) {
 
                     // register the lua callback function (pops stack)
+                    uint64_t code_hash = bytecode_hash(L, -1);
                     ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
                     // hook type (see utils.c)
@@ -468,7 +553,114 @@ static void bar_config(lua_State *L) {
                                 side_str);
                     }
 
-                    add_widget(side, hook, ref);
+                    // optional: interval in seconds for periodic hooks and
+                    // alignment of the ticks to the wall clock
+                    if (lua_getfield(L, widget, "interval") == LUA_TNUMBER) {
+                        // the timer takes uint32_t ms, NaN fails too
+                        lua_Number secs = lua_tonumber(L, -1);
+                        if (!(secs >= 0.001 && secs <= UINT32_MAX / 1000)) {
+                            luaL_error(L, "Widget interval must be between "
+                                    "0.001 and %d seconds",
+                                    (int) (UINT32_MAX / 1000));
+                        }
+                        interval_ms = secs * 1000;
+                    }
+                    lua_pop(L, 1);
+                    set_conf_bool(L, "align", &align, widget);
+
+                    if (hook == HOOK_PERIODIC && interval_ms == 0) {
+                        luaL_error(L, "Widgets using \'hook_periodic\' need "
+                                      "an interval");
+                    }
+
+                    struct status_entry_t *e = widget_new(side, hook, ref, i+1,
+                            interval_ms, align);
+                    vector_add(widgets_out, e);
+                    e->code_hash = code_hash;
+
+                    // optional: limits of the callback, see budget.h
+                    budget_init(&e->budget, config->budgets[BUDGET_WIDGET]);
+                    set_conf_budget(L, "budget", &e->budget.limit, widget);
+
+                    // optional: scope, "global" (default) or "output"
+                    if (lua_getfield(L, widget, "scope") == LUA_TSTRING) {
+                        const char *scope = lua_tostring(L, -1);
+                        if (!strcmp(scope, "output")) {
+                            e->scope = SCOPE_OUTPUT;
+                        } else if (strcmp(scope, "global")) {
+                            luaL_error(L, "Invalid widget scope: %s", scope);
+                        }
+                    }
+                    lua_pop(L, 1);
+
+                    // optional: function returning the content for the next
+                    // tick, periodic global widgets only
+                    if (lua_getfield(L, widget, "next") == LUA_TFUNCTION) {
+                        if (hook != HOOK_PERIODIC_SLOW &&
+                            hook != HOOK_PERIODIC_FAST &&
+                            hook != HOOK_PERIODIC) {
+                            luaL_error(L, "Only periodic widgets can have a "
+                                          "\'next\' function");
+                        }
+                        if (e->scope != SCOPE_GLOBAL) {
+                            luaL_error(L, "Per-output widgets can\'t have a "
+                                          "\'next\' function");
+                        }
+                        e->precompute = true;
+                        e->code_hash = e->code_hash * 31 +
+                            bytecode_hash(L, -1);
+                    }
+                    lua_pop(L, 1);
+
+                    // optional: event sources, a string or a list of them
+                    int t = lua_getfield(L, widget, "watch");
+                    if (t == LUA_TSTRING) {
+                        const char *src = lua_tostring(L, -1);
+                        if (!widget_watch(e, src)) {
+                            luaL_error(L, "Invalid widget source: %s", src);
+                        }
+                    } else if (t == LUA_TTABLE) {
+                        uint32_t n = lua_rawlen(L, -1);
+                        for (uint32_t j = 0; j < n; j++) {
+                            if (lua_geti(L, -1, j+1) != LUA_TSTRING ||
+                                !widget_watch(e, lua_tostring(L, -1))) {
+                                luaL_error(L, "Invalid widget source");
+                            }
+                            lua_pop(L, 1);
+                        }
+                    }
+                    lua_pop(L, 1);
+
+                    // optional: compositor events, see events.h
+                    t = lua_getfield(L, widget, "events");
+                    if (t == LUA_TSTRING) {
+                        const char *name = lua_tostring(L, -1);
+                        e->events = event_str_to_enum(name);
+                        if (!e->events) {
+                            luaL_error(L, "Invalid widget event: %s", name);
+                        }
+                    } else if (t == LUA_TTABLE) {
+                        uint32_t n = lua_rawlen(L, -1);
+                        for (uint32_t j = 0; j < n; j++) {
+                            enum event_t ev = 0;
+                            if (lua_geti(L, -1, j+1) == LUA_TSTRING) {
+                                ev = event_str_to_enum(lua_tostring(L, -1));
+                            }
+                            if (!ev) {
+                                luaL_error(L, "Invalid widget event");
+                            }
+                            e->events |= ev;
+                            lua_pop(L, 1);
+                        }
+                    }
+                    lua_pop(L, 1);
+
+                    if (hook == HOOK_EVENT && !e->watch && !e->watch_files &&
+                        !e->events) {
+                        luaL_error(L, "Widgets using \'hook_event\' need a "
+                                      "source or an event to watch");
+                    }
+
                     lua_pop(L, 2);
                 } else {
                     luaL_error(L, "Invalid entry in widgets subtable");
@@ -481,8 +673,8 @@ static void bar_config(lua_State *L) {
     lua_settop(L, 0);
 }
 
-static void read_config(lua_State *L) {
-    if (lua_getglobal(L_config, "config") != LUA_TTABLE) {
+static void read_config(lua_State *L, struct wavy_config_t *config) {
+    if (lua_getglobal(L, "config") != LUA_TTABLE) {
         lua_settop(L, 0);
         return;
     }
@@ -505,19 +697,84 @@ static void read_config(lua_State *L) {
             &config->view_border_active_color, -1);
     set_conf_int(L, "view_border_inactive_color",
             &config->view_border_inactive_color, -1);
+    set_conf_int(L, "view_update_interval", &config->view_update_interval,
+            -1);
+
+    if (lua_getfield(L, -1, "budgets") == LUA_TTABLE) {
+        set_conf_budget(L, "widget", &config->budgets[BUDGET_WIDGET], -1);
+        set_conf_budget(L, "keybinding", &config->budgets[BUDGET_KEYBINDING],
+                -1);
+    }
+    lua_pop(L, 1);
+    set_conf_int(L, "budget_cooldown", &config->budget_cooldown, -1);
+    set_conf_int(L, "profiler_interval", &config->profiler_interval, -1);
+    set_conf_int(L, "lua_memory_limit", &config->lua_memory_limit, -1);
 
     set_conf_str(L, "wallpaper", &config->wallpaper, -1);
 
     // expand file path
     wordexp_t f;
-    wordexp(config->wallpaper, &f, 0);
-    config->wallpaper = f.we_wordv[0];
+    if (config->wallpaper && wordexp(config->wallpaper, &f, 0) == 0) {
+        if (f.we_wordc > 0) {
+            free(config->wallpaper);
+            config->wallpaper = strdup(f.we_wordv[0]);
+        }
+        wordfree(&f);
+    }
 
-    set_layouts(L);
-    set_autostart(L);
+    set_layouts(L, config);
+    set_autostart(L, config);
     lua_settop(L, 0);
 }
 
+// adds up the hashes of the fields of the table on top of the stack,
+// tables nested deeper than 'depth' are skipped
+static uint64_t table_hash(lua_State *L, uint32_t depth) {
+    uint64_t h = 0;
+    int32_t t = lua_gettop(L);
+    lua_pushnil(L);
+    while (lua_next(L, t) != 0) {
+        h += (bytecode_hash(L, -2) | 1) * bytecode_hash(L, -1);
+        if (depth > 0 && lua_istable(L, -1) && !lua_rawequal(L, -1, t)) {
+            h += table_hash(L, depth - 1);
+        }
+        lua_pop(L, 1);
+    }
+    return h;
+}
+
+// hash of the globals and of the fields of global tables (e.g. the
+// wavy_utils module). widgets use them, so the widgets are restarted by a
+// reload if one of them changed. the tables read above are compared field
+// by field instead. the order of the fields differs between states, their
+// sum doesn't.
+static uint64_t globals_hash(lua_State *L) {
+    static const char *read[] = {
+        "config", "layouts", "autostart", "bar", "input", "keys"
+    };
+
+    uint64_t h = 0;
+    lua_pushglobaltable(L);
+    int32_t globals = lua_gettop(L);
+    lua_pushnil(L);
+    while (lua_next(L, globals) != 0) {
+        bool skip = lua_rawequal(L, -1, globals);
+        for (uint32_t i = 0; i < 6 && !skip; i++) {
+            skip = lua_type(L, -2) == LUA_TSTRING &&
+                   !strcmp(lua_tostring(L, -2), read[i]);
+        }
+        if (!skip) {
+            h += (bytecode_hash(L, -2) | 1) * bytecode_hash(L, -1);
+            if (lua_istable(L, -1)) {
+                h += table_hash(L, 0);
+            }
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    return h;
+}
+
 static char *get_config_file_path() {
     static const char *files[] = {
         "$XDG_CONFIG_HOME/wavy/config.lua",
@@ -544,75 +801,55 @@ static char *get_config_file_path() {
     return c_file;
 }
 
-// function to be called when an error in lua_pcall occurs
-static int msghandler(lua_State *L) {
-    const char *msg = lua_tostring(L, -1);
-    if (!msg) {
-        return 1;
+lua_State *load_config_state(const char *file, enum luamem_subsys_t subsys) {
+    lua_State *L = luamem_newstate(subsys);
+    if (!L) {
+        wavy_log(LOG_ERROR, "Failed to create a lua_State");
+        return NULL;
     }
-    luaL_traceback(L, L, msg, 1);
-    const char *trace = lua_tostring(L, -1);
-    lua_writestringerror("%s\n", trace);
-    return 1;
-}
+    profiler_attach(L);
+    luaL_openlibs(L);
+    bytecode_preload(L);
 
-void init_config() {
-    config = calloc(1, sizeof(struct wavy_config_t));
-    if (!config) {
-        wavy_log(LOG_DEBUG, "Failed to allocate memory for configuration");
-        exit(EXIT_FAILURE);
-    }
-    config->autostart = vector_init();
-    config->input_configs = vector_init();
-
-    const char *config_file = get_config_file_path();
-    if (!config_file) {
-        wavy_log(LOG_ERROR, "No config file found");
-        exit(EXIT_FAILURE);
-    }
-    wavy_log(LOG_DEBUG, "Loading config file: %s", config_file);
-
-    L_config = luaL_newstate();
-    luaL_openlibs(L_config);
-    int32_t err_load = luaL_loadfile(L_config, config_file);
+    int32_t err_load = bytecode_loadfile(L, file);
     if (err_load != LUA_OK) {
-        if (err_load == LUA_ERRFILE) {
-            wavy_log(LOG_ERROR, "Error loading config.lua");
-        } else if (err_load == LUA_ERRSYNTAX) {
-            const char *msg = lua_tostring(L_config, -1);
+        if (err_load == LUA_ERRSYNTAX) {
+            const char *msg = lua_tostring(L, -1);
             if (msg) {
                 wavy_log(LOG_ERROR, "%s", msg);
             } else {
                 wavy_log(LOG_ERROR, "Syntax error in config.lua");
             }
+        } else {
+            wavy_log(LOG_ERROR, "Error loading config.lua");
         }
-        exit(EXIT_FAILURE);
+        luamem_close(L);
+        return NULL;
     }
 
     // push a msghandler on the stack which prints a stacktrace when
     // lua_pcall fails
-    int32_t base = lua_gettop(L_config);
-    lua_pushcfunction(L_config, msghandler);
-    lua_insert(L_config, base);
+    int32_t base = lua_gettop(L);
+    lua_pushcfunction(L, traceback_msghandler);
+    lua_insert(L, base);
 
     // execute the script and initialize its global variables
-    int32_t status = lua_pcall(L_config, 0, 0, base);
+    int32_t status = lua_pcall(L, 0, 0, base);
+    lua_settop(L, 0);
 
     if (status != LUA_OK) {
-        luaL_error(L_config, "Runtime error");
+        wavy_log(LOG_ERROR, "Runtime error in config.lua");
+        luamem_close(L);
+        return NULL;
     }
 
-    default_config();
-    read_config(L_config);
-    bar_config(L_config);
-    input_configs_init(L_config);
-    keybind_config(L_config);
-    free((void *) config_file);
+    return L;
 }
 
 static void free_input_config(void *_ic) {
     struct input_config *ic = _ic;
     free((void *) ic->name);
+    free(ic);
 }
 
 // needs a terminating null pointer!
@@ -626,11 +863,321 @@ static void free_char_char(void *_cc) {
     free(cc);
 }
 
-void free_config() {
-    lua_close(L_config);
+static struct wavy_config_t *config_new(const char *file) {
+    struct wavy_config_t *c = calloc(1, sizeof(struct wavy_config_t));
+    if (!c) {
+        wavy_log(LOG_ERROR, "Failed to allocate memory for configuration");
+        return NULL;
+    }
+    c->autostart = vector_init();
+    c->input_configs = vector_init();
+    c->file = strdup(file);
+    default_config(c);
+    return c;
+}
+
+static void config_free(struct wavy_config_t *c) {
+    free(c->statusbar_font);
+    free(c->wallpaper);
+    for (uint32_t i = 0; i < 5; i++) {
+        free(c->tile_layout_strs[i]);
+    }
+    vector_foreach(c->autostart, free_char_char);
+    vector_free(c->autostart);
+    vector_foreach(c->input_configs, free_input_config);
+    vector_free(c->input_configs);
+    free(c->file);
+    free(c);
+}
+
+static void config_load_free(struct config_load_t *l) {
+    vector_foreach(l->keybindings, keybind_free);
+    vector_free(l->keybindings);
+    vector_foreach(l->widgets, widget_free);
+    vector_free(l->widgets);
+    if (l->config) {
+        config_free(l->config);
+    }
+    if (l->L) {
+        luamem_close(l->L);
+    }
+    free(l);
+}
+
+// reads the tables of the config. called in protected mode, so an invalid
+// config is reported instead of taking down the compositor.
+static int read_state(lua_State *L) {
+    struct config_load_t *l = lua_touserdata(L, 1);
+    lua_settop(L, 0);
+    read_config(L, l->config);
+    bar_config(L, l->config, l->widgets);
+    input_configs_init(L, l->config);
+    keybind_config(L, l->keybindings);
+    l->globals_hash = globals_hash(L);
+    return 0;
+}
+
+// runs and reads a config file, touches nothing of the running compositor.
+// returns NULL (and logs the error) if the config is invalid.
+static struct config_load_t *config_load(const char *file) {
+    struct config_load_t *l = calloc(1, sizeof(struct config_load_t));
+    if (!l) {
+        wavy_log(LOG_ERROR, "Failed to allocate memory for configuration");
+        return NULL;
+    }
+    l->keybindings = vector_init();
+    l->widgets = vector_init();
+    l->config = config_new(file);
+    l->L = load_config_state(file, LUAMEM_CONFIG);
+    if (!l->config || !l->L) {
+        config_load_free(l);
+        return NULL;
+    }
+
+    // keybindings that wait for a command are resumed in this state, even
+    // if it was replaced by a reload in the meantime
+    async_set_runner(l->L, lua_cmd_resume, l->L);
+
+    lua_pushcfunction(l->L, traceback_msghandler);
+    lua_pushcfunction(l->L, read_state);
+    lua_pushlightuserdata(l->L, l);
+    int32_t status = lua_pcall(l->L, 1, 0, 1);
+    lua_settop(l->L, 0);
+    if (status != LUA_OK) {
+        wavy_log(LOG_ERROR, "Invalid configuration in %s", file);
+        config_load_free(l);
+        return NULL;
+    }
+    return l;
+}
+
+void init_config() {
+    char *file = get_config_file_path();
+    if (!file) {
+        wavy_log(LOG_ERROR, "No config file found");
+        exit(EXIT_FAILURE);
+    }
+    wavy_log(LOG_DEBUG, "Loading config file: %s", file);
+
+    struct config_load_t *l = config_load(file);
+    free(file);
+    if (!l) {
+        exit(EXIT_FAILURE);
+    }
+
+    config = l->config;
+    L_config = l->L;
+    luamem_set_limit((size_t) config->lua_memory_limit * 1024);
+    live_globals_hash = l->globals_hash;
+    bar_replace_widgets(l->widgets);
+    cmd_replace(l->keybindings);
+    free(l);
+}
+
+static void retire(char *str) {
+    if (!str) {
+        return;
+    }
+    if (!retired) {
+        retired = vector_init();
+    }
+    vector_add(retired, str);
+}
+
+// replaces the live config with c, which is freed. the live struct stays
+// where it is, every module keeps a pointer to it.
+static void replace_config(struct wavy_config_t *c) {
+    retire(config->statusbar_font);
+    retire(config->wallpaper);
+    for (uint32_t i = 0; i < 5; i++) {
+        retire(config->tile_layout_strs[i]);
+    }
     vector_foreach(config->autostart, free_char_char);
     vector_free(config->autostart);
     vector_foreach(config->input_configs, free_input_config);
     vector_free(config->input_configs);
-    free(config);
+    free(c->file);
+    c->file = config->file;
+
+    *config = *c;
+    free(c);
+}
+
+static bool widgets_equal(struct vector_t *a, struct vector_t *b) {
+    if (a->length != b->length) {
+        return false;
+    }
+    for (uint32_t i = 0; i < a->length; i++) {
+        if (!widget_equal(a->items[i], b->items[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool str_changed(const char *a, const char *b) {
+    return (a && b) ? strcmp(a, b) != 0 : a != b;
+}
+
+// compares a reloaded config with the live one and only redoes what
+// depends on the parts that changed. main loop only.
+static void apply_reload(void *data) {
+    struct config_load_t *l = data;
+    struct wavy_config_t *c = l->config;
+
+    // sizes move views, colors only need the borders repainted
+    bool relayout =
+        c->frame_gaps_size != config->frame_gaps_size ||
+        c->frame_border_size != config->frame_border_size ||
+        c->frame_border_empty_size != config->frame_border_empty_size ||
+        c->view_border_size != config->view_border_size ||
+        c->statusbar_height != config->statusbar_height ||
+        c->statusbar_position != config->statusbar_position ||
+        c->num_layouts != config->num_layouts ||
+        memcmp(c->tile_layouts, config->tile_layouts,
+                sizeof(c->tile_layouts)) != 0;
+    bool borders =
+        c->frame_border_active_color != config->frame_border_active_color ||
+        c->frame_border_inactive_color !=
+            config->frame_border_inactive_color ||
+        c->frame_border_empty_active_color !=
+            config->frame_border_empty_active_color ||
+        c->frame_border_empty_inactive_color !=
+            config->frame_border_empty_inactive_color ||
+        c->view_border_active_color != config->view_border_active_color ||
+        c->view_border_inactive_color != config->view_border_inactive_color;
+
+    // the cached strips and the glyph atlas depend on the font and size
+    bool restyle =
+        str_changed(c->statusbar_font, config->statusbar_font) ||
+        c->statusbar_padding != config->statusbar_padding ||
+        c->statusbar_height != config->statusbar_height ||
+        c->statusbar_glyph_atlas != config->statusbar_glyph_atlas;
+    bool bar = restyle || relayout ||
+        c->statusbar_gap != config->statusbar_gap ||
+        c->statusbar_bg_color != config->statusbar_bg_color ||
+        c->statusbar_active_ws_color != config->statusbar_active_ws_color ||
+        c->statusbar_inactive_ws_color !=
+            config->statusbar_inactive_ws_color ||
+        c->statusbar_active_ws_font_color !=
+            config->statusbar_active_ws_font_color ||
+        c->statusbar_inactive_ws_font_color !=
+            config->statusbar_inactive_ws_font_color ||
+        c->statusbar_separator_enabled !=
+            config->statusbar_separator_enabled ||
+        c->statusbar_separator_color != config->statusbar_separator_color ||
+        c->statusbar_separator_width != config->statusbar_separator_width;
+
+    // the bar host draws with the font it was started with
+    bool widgets =
+        l->globals_hash != live_globals_hash ||
+        c->statusbar_workers != config->statusbar_workers ||
+        c->statusbar_host != config->statusbar_host ||
+        (c->statusbar_host && restyle) ||
+        !widgets_equal(get_widgets(), l->widgets);
+
+    bool profiler = c->profiler_interval != config->profiler_interval;
+    if (str_changed(c->wallpaper, config->wallpaper)) {
+        wavy_log(LOG_WAVY, "The wallpaper changes on the next start");
+    }
+
+    if (widgets) {
+        free_sources();
+        free_scheduler();
+        free_barhost();
+        stop_workers();
+    }
+
+    bar_pause_render();
+    replace_config(c);
+    bar_resume_render(restyle);
+    luamem_set_limit((size_t) config->lua_memory_limit * 1024);
+
+    if (widgets) {
+        live_globals_hash = l->globals_hash;
+        bar_replace_widgets(l->widgets);
+        init_workers();
+        init_barhost();
+        init_scheduler();
+        init_sources();
+        struct vector_t *w = get_widgets();
+        queue_widgets((struct status_entry_t **) w->items, w->length);
+    } else {
+        vector_foreach(l->widgets, widget_free);
+        vector_free(l->widgets);
+    }
+
+    pthread_mutex_lock(&lua_lock);
+    lua_State *old = L_config;
+    L_config = l->L;
+    uint32_t unchanged = cmd_replace(l->keybindings);
+    uint32_t total = l->keybindings->length;
+    pthread_mutex_unlock(&lua_lock);
+
+    // otherwise closed by the last keybinding that waits for a command
+    if (!async_threads_pending(old)) {
+        luamem_close(old);
+    }
+
+    if (relayout) {
+        layout_reconfigure();
+    } else if (borders) {
+        layout_repaint_borders();
+    }
+    if (bar) {
+        bar_request_repaint_all();
+    }
+    if (profiler) {
+        profiler_set_enabled(profiler_enabled()); // rearms the report timer
+    }
+
+    wavy_log(LOG_WAVY, "Config reloaded: layout %s, borders %s, bar %s, "
+            "widgets %s, %u of %u keybindings unchanged",
+            relayout ? "updated" : "kept",
+            relayout || borders ? "updated" : "kept",
+            restyle ? "restyled" : bar ? "repainted" : "kept",
+            widgets ? "restarted" : "kept", unchanged, total);
+
+    free(l);
+    __atomic_store_n(&reloading, false, __ATOMIC_RELEASE);
+}
+
+static void *reload_thread(void *arg) {
+    char *file = arg;
+    struct config_load_t *l = config_load(file);
+    free(file);
+    if (!l) {
+        wavy_log(LOG_ERROR, "Reload failed, keeping the current config");
+        __atomic_store_n(&reloading, false, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    loop_call(apply_reload, l);
+    return NULL;
+}
+
+void config_reload() {
+    if (__atomic_exchange_n(&reloading, true, __ATOMIC_ACQ_REL)) {
+        wavy_log(LOG_DEBUG, "The config is already being reloaded");
+        return;
+    }
+
+    char *file = strdup(config->file);
+    pthread_t thread;
+    if (!file || pthread_create(&thread, NULL, reload_thread, file) != 0) {
+        wavy_log(LOG_ERROR, "Failed to start reloading the config");
+        free(file);
+        __atomic_store_n(&reloading, false, __ATOMIC_RELEASE);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+void free_config() {
+    luamem_close(L_config);
+    config_free(config);
+    if (retired) {
+        vector_foreach(retired, free);
+        vector_free(retired);
+        retired = NULL;
+    }
 }
@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <wlc/wlc.h>
+
+#include "events.h"
+#include "async.h"
+#include "bar.h"
+#include "budget.h"
+#include "config.h"
+#include "loop.h"
+#include "snapshot.h"
+#include "workers.h"
+#include "log.h"
+#include "luamem.h"
+#include "vector.h"
+
+// subscribers of a lua_State: a list of {mask, function, budget}, the
+// budget is a userdata holding a struct budget_t, so an overrun disables
+// the subscriber like a keybinding
+#define EVENTS_SUBSCRIBERS "wavy.events"
+
+struct event_data_t {
+    enum event_t type;
+    wlc_handle view;
+    wlc_handle output;
+    uint32_t workspace;
+    char *title;
+    char *app_id;
+};
+
+static const struct {
+    enum event_t type;
+    const char *name;
+} event_names[] = {
+    {EVENT_VIEW_CREATED, "view_created"},
+    {EVENT_VIEW_DESTROYED, "view_destroyed"},
+    {EVENT_FOCUS_CHANGED, "focus_changed"},
+    {EVENT_WORKSPACE_SWITCHED, "workspace_switched"},
+    {EVENT_OUTPUT_ADDED, "output_added"},
+    {EVENT_TITLE_CHANGED, "title_changed"},
+};
+
+#define NUM_EVENTS (sizeof(event_names) / sizeof(event_names[0]))
+
+// *event_data_t's of the current loop iteration, main loop only
+static struct vector_t *pending = NULL;
+
+enum event_t event_str_to_enum(const char *name) {
+    for (uint32_t i = 0; i < NUM_EVENTS; i++) {
+        if (!strcmp(event_names[i].name, name)) {
+            return event_names[i].type;
+        }
+    }
+    return 0;
+}
+
+static const char *event_str(enum event_t type) {
+    for (uint32_t i = 0; i < NUM_EVENTS; i++) {
+        if (event_names[i].type == type) {
+            return event_names[i].name;
+        }
+    }
+    return "unknown";
+}
+
+static void event_free(void *data) {
+    struct event_data_t *ev = data;
+    free(ev->title);
+    free(ev->app_id);
+    free(ev);
+}
+
+static void push_event(lua_State *L, struct event_data_t *ev) {
+    lua_createtable(L, 0, 6);
+    lua_pushstring(L, event_str(ev->type));
+    lua_setfield(L, -2, "type");
+    if (ev->view) {
+        lua_pushinteger(L, ev->view);
+        lua_setfield(L, -2, "view");
+        lua_pushstring(L, ev->title);
+        lua_setfield(L, -2, "title");
+        lua_pushstring(L, ev->app_id);
+        lua_setfield(L, -2, "app_id");
+    }
+    if (ev->output) {
+        lua_pushinteger(L, ev->output);
+        lua_setfield(L, -2, "output");
+    }
+    if (ev->workspace) {
+        lua_pushinteger(L, ev->workspace);
+        lua_setfield(L, -2, "workspace");
+    }
+}
+
+// queues the widgets listening to one of the events, per-output widgets
+// only for the output of the events if they all happened on the same one
+static void queue_event_widgets(struct vector_t *events, uint32_t mask) {
+    wlc_handle output = 0;
+    for (uint32_t i = 0; i < events->length; i++) {
+        struct event_data_t *ev = events->items[i];
+        if (!ev->output || (i > 0 && ev->output != output)) {
+            output = 0;
+            break;
+        }
+        output = ev->output;
+    }
+
+    struct vector_t *widgets = get_widgets();
+    struct vector_t *batch = vector_init();
+    for (uint32_t i = 0; i < widgets->length; i++) {
+        struct status_entry_t *e = widgets->items[i];
+        if (e->events & mask) {
+            vector_add(batch, e);
+        }
+    }
+    if (batch->length > 0) {
+        queue_widgets_output((struct status_entry_t **) batch->items,
+                batch->length, output);
+    }
+    vector_free(batch);
+}
+
+// runs the subscribers of the config like lua keybindings: in a coroutine
+// that can wait for commands, under the keybinding budget
+static void call_subscribers(lua_State *L, struct vector_t *events,
+        uint32_t mask) {
+
+    int top = lua_gettop(L);
+    if (lua_getfield(L, LUA_REGISTRYINDEX, EVENTS_SUBSCRIBERS) !=
+        LUA_TTABLE) {
+        lua_settop(L, top);
+        return;
+    }
+    int subs = lua_gettop(L);
+
+    uint32_t n = lua_rawlen(L, subs);
+    for (uint32_t i = 0; i < n; i++) {
+        lua_rawgeti(L, subs, i+1);
+        lua_rawgeti(L, -1, 1);
+        uint32_t sub_mask = lua_tointeger(L, -1);
+        lua_rawgeti(L, -2, 3);
+        struct budget_t *budget = lua_touserdata(L, -1);
+        lua_pop(L, 2);
+        if (!(sub_mask & mask) || !budget) {
+            lua_pop(L, 1);
+            continue;
+        }
+        if (!budget_enabled(budget)) {
+            wavy_log(LOG_DEBUG,
+                    "Lua event subscriber is disabled after an overrun");
+            lua_pop(L, 1);
+            continue;
+        }
+
+        lua_rawgeti(L, -1, 2);
+        lua_State *co = async_thread_new(L);
+        lua_createtable(co, events->length, 0);
+        for (uint32_t j = 0, k = 0; j < events->length; j++) {
+            struct event_data_t *ev = events->items[j];
+            if (ev->type & sub_mask) {
+                push_event(co, ev);
+                lua_rawseti(co, -2, ++k);
+            }
+        }
+
+        // the limits of the config can change with a reload
+        budget->limit = config->budgets[BUDGET_KEYBINDING];
+        budget_start(co, budget);
+        int status = async_resume(co, 1);
+        budget_end(co, "Lua event subscriber");
+        if (status != LUA_YIELD) {
+            // the error was logged by async_resume
+            async_thread_free(L, co);
+        }
+        lua_pop(L, 1);
+    }
+    lua_settop(L, top);
+    luamem_collect(L);
+}
+
+static void events_dispatch(void *data) {
+    (void) data;
+    struct vector_t *events = pending;
+    pending = NULL;
+    if (!events) {
+        return;
+    }
+
+    // the widgets and subscribers read the layout through the snapshot
+    snapshot_flush();
+
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < events->length; i++) {
+        struct event_data_t *ev = events->items[i];
+        mask |= ev->type;
+    }
+    queue_event_widgets(events, mask);
+
+    pthread_mutex_lock(&lua_lock);
+    enum luamem_subsys_t prev = luamem_set_subsys(L_config,
+            LUAMEM_KEYBINDINGS);
+    call_subscribers(L_config, events, mask);
+    luamem_set_subsys(L_config, prev);
+    pthread_mutex_unlock(&lua_lock);
+
+    vector_foreach(events, event_free);
+    vector_free(events);
+}
+
+void event_emit(enum event_t type, wlc_handle view, wlc_handle output,
+        uint32_t workspace) {
+
+    struct event_data_t *ev = calloc(1, sizeof(struct event_data_t));
+    if (!ev) {
+        wavy_log(LOG_ERROR, "Failed to allocate event");
+        return;
+    }
+    ev->type = type;
+    ev->view = view;
+    ev->output = output;
+    ev->workspace = workspace;
+    if (view) {
+        const char *title = wlc_view_get_title(view);
+        const char *app_id = wlc_view_get_app_id(view);
+        ev->title = strdup(title ? title : "");
+        ev->app_id = strdup(app_id ? app_id : "");
+    }
+    snapshot_invalidate();
+
+    // the first event of an iteration schedules the delivery
+    if (!pending) {
+        pending = vector_init();
+        loop_call(events_dispatch, NULL);
+    }
+    vector_add(pending, ev);
+}
+
+int events_subscribe(lua_State *L) {
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    uint32_t mask = 0;
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        mask = event_str_to_enum(lua_tostring(L, 1));
+        if (!mask) {
+            return luaL_error(L, "Unknown event: %s", lua_tostring(L, 1));
+        }
+    } else {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        uint32_t n = lua_rawlen(L, 1);
+        for (uint32_t i = 0; i < n; i++) {
+            if (lua_geti(L, 1, i+1) != LUA_TSTRING) {
+                return luaL_error(L, "Event names must be strings");
+            }
+            enum event_t ev = event_str_to_enum(lua_tostring(L, -1));
+            if (!ev) {
+                return luaL_error(L, "Unknown event: %s", lua_tostring(L, -1));
+            }
+            mask |= ev;
+            lua_pop(L, 1);
+        }
+    }
+
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, EVENTS_SUBSCRIBERS);
+    lua_createtable(L, 2, 0);
+    lua_pushinteger(L, mask);
+    lua_rawseti(L, -2, 1);
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, 2);
+
+    // the limits are set when it runs, the config might not be live yet
+    struct budget_t *budget = lua_newuserdata(L, sizeof(struct budget_t));
+    struct budget_limit_t no_limit = {0};
+    budget_init(budget, no_limit);
+    lua_rawseti(L, -2, 3);
+    lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+    return 0;
+}
+
+void free_events() {
+    if (pending) {
+        vector_foreach(pending, event_free);
+        vector_free(pending);
+        pending = NULL;
+    }
+}
@@ -160,7 +160,7 @@ static void apply_input_config(struct input_config *ic,
     }
 }
 
-void input_configs_init(lua_State *L) {
+void input_configs_init(lua_State *L, struct wavy_config_t *c) {
     if (lua_getglobal(L, "input") != LUA_TTABLE) {
         lua_settop(L, 0);
         return;
@@ -183,7 +183,7 @@ void input_configs_init(lua_State *L) {
             wavy_log(LOG_ERROR, "Failed to allocate input config");
             continue;
         }
-        vector_add(config->input_configs, ic);
+        vector_add(c->input_configs, ic);
         ic->name = dev_name;
 
         // INT_MIN signifies an unset variable
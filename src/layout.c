@@ -14,6 +14,7 @@
 #include "border.h"
 #include "bar.h"
 #include "utils.h"
+#include "events.h"
 
 // find the index of a view in a frame
 static uint32_t frame_get_index_of_view(struct frame *fr, wlc_handle view) {
@@ -189,6 +190,138 @@ struct vector_t *get_outputs() {
     return outputs;
 }
 
+// layout operations in a batch only note what they would redraw, repaint or
+// render. it is done once when the outermost batch ends. main loop only.
+static uint32_t batch_depth = 0;
+static struct vector_t *batch_workspaces = NULL; // *workspace's to redraw
+static bool batch_realloc = false;
+static bool batch_bar = false;
+static bool batch_render = false;
+
+// active frame and view the last focus_changed event was about, and whether
+// a view outside of the frames (e.g. a floating one) got focus since
+static struct frame *focus_frame = NULL;
+static wlc_handle focus_view_handle = 0;
+static bool focus_elsewhere = false;
+
+// emits focus_changed when the active frame or its view changed, also if the
+// new frame is empty and no view gets focus
+static void layout_check_focus() {
+    struct frame *fr = get_active_frame();
+    wlc_handle view = get_active_view();
+    if (fr == focus_frame && view == focus_view_handle) {
+        return;
+    }
+    focus_frame = fr;
+    focus_view_handle = view;
+    focus_elsewhere = false;
+    event_emit(EVENT_FOCUS_CHANGED, view,
+            active_output ? active_output->output_handle : 0, 0);
+}
+
+void layout_view_focused(wlc_handle view) {
+    if (view != get_active_view()) {
+        focus_elsewhere = true;
+        event_emit(EVENT_FOCUS_CHANGED, view, wlc_view_get_output(view), 0);
+    } else {
+        if (focus_elsewhere) {
+            focus_frame = NULL; // back to the active view, report it again
+        }
+        layout_check_focus();
+    }
+}
+
+// called before a frame is freed, a new frame at the same address would
+// look like the focused one otherwise
+static void focus_forget(struct frame *fr) {
+    if (fr == focus_frame) {
+        focus_frame = NULL;
+    }
+}
+
+static struct workspace *workspace_by_frame(struct frame *fr) {
+    while (fr && fr->parent) {
+        fr = fr->parent;
+    }
+    for (uint32_t i = 0; fr && i < workspaces->length; i++) {
+        struct workspace *ws = workspaces->items[i];
+        if (ws->root_frame == fr) {
+            return ws;
+        }
+    }
+    return NULL;
+}
+
+static void batch_add_redraw(struct frame *fr, bool realloc) {
+    struct workspace *ws = workspace_by_frame(fr);
+    batch_realloc |= realloc;
+    batch_render = true;
+    for (uint32_t i = 0; ws && i < batch_workspaces->length; i++) {
+        if (batch_workspaces->items[i] == ws) {
+            return;
+        }
+    }
+    if (ws) {
+        vector_add(batch_workspaces, ws);
+    }
+}
+
+static void layout_schedule_render(wlc_handle output) {
+    if (batch_depth) {
+        batch_render = true;
+        return;
+    }
+    wlc_output_schedule_render(output);
+}
+
+static void layout_bar_repaint(struct output *out) {
+    if (batch_depth) {
+        batch_bar = true;
+        return;
+    }
+    bar_request_repaint(out);
+}
+
+// every bar shows all workspaces, so all of them change with the list
+static void layout_bar_repaint_all() {
+    for (uint32_t i = 0; i < outputs->length; i++) {
+        layout_bar_repaint(outputs->items[i]);
+    }
+}
+
+void layout_batch_begin() {
+    if (batch_depth++ == 0) {
+        batch_workspaces = vector_init();
+    }
+}
+
+void layout_batch_end() {
+    if (batch_depth == 0 || --batch_depth > 0) {
+        return;
+    }
+
+    // workspaces that were hidden in the meantime are redrawn when they are
+    // shown again, redrawing them now would make their views visible
+    for (uint32_t i = 0; i < batch_workspaces->length; i++) {
+        struct workspace *ws = batch_workspaces->items[i];
+        if (ws->is_visible) {
+            frame_redraw(ws->root_frame, batch_realloc);
+        }
+    }
+    for (uint32_t i = 0; batch_bar && i < outputs->length; i++) {
+        bar_request_repaint(outputs->items[i]);
+    }
+    if (batch_render) {
+        schedule_render_all_outputs();
+    }
+
+    vector_free(batch_workspaces);
+    batch_workspaces = NULL;
+    batch_realloc = false;
+    batch_bar = false;
+    batch_render = false;
+}
+
 // Allocates a new workspace
 static struct workspace *alloc_next_workspace() {
     struct workspace *ws_new = malloc(sizeof(struct workspace));
@@ -268,7 +401,7 @@ static void workspace_assign_output(struct workspace *ws, struct output *out) {
     ws->assigned_output = out;
     frame_recalc_geometries(ws->root_frame, g);
     frame_redraw(ws->root_frame, true);
-    wlc_output_schedule_render(out->output_handle);
+    layout_schedule_render(out->output_handle);
 }
 
 static void output_update_resolution(struct output *out, uint32_t width,
@@ -293,10 +426,8 @@ static void output_update_resolution(struct output *out, uint32_t width,
     }
 
     frame_redraw(out->active_ws->root_frame, true);
-    out->bar.g.size.w = width;
-    out->bar.dirty = true;
-    update_bar(out);
-    wlc_output_schedule_render(out->output_handle);
+    layout_bar_repaint(out);
+    layout_schedule_render(out->output_handle);
 }
 
 void add_output(wlc_handle output) {
@@ -387,12 +518,14 @@ void workspace_switch_to(uint32_t num) {
     }
 
     active_output->active_ws->is_visible = true;
-    update_bar(active_output);
+    layout_bar_repaint(active_output);
     frame_redraw(active_output->active_ws->root_frame, true);
     frame_views_set_mask(active_output->active_ws->root_frame, 1);
     workspace_floating_set_mask(active_output->active_ws, 1);
     wlc_view_focus(get_active_view());
-    wlc_output_schedule_render(active_output->output_handle);
+    layout_schedule_render(active_output->output_handle);
+    event_emit(EVENT_WORKSPACE_SWITCHED, 0, active_output->output_handle,
+            num + 1);
 }
 
 void frame_recalc_geometries(struct frame *fr, struct wlc_geometry g) {
@@ -632,8 +765,20 @@ static void _frame_redraw(struct frame *fr, bool realloc) {
 }
 
 void frame_redraw(struct frame *fr, bool realloc) {
+    if (batch_depth) {
+        batch_add_redraw(fr, realloc);
+        return;
+    }
     _frame_redraw(fr, realloc);
-    trigger_hook(HOOK_VIEW_UPDATE);
+
+    // the frame isn't necessarily on the focused output
+    struct workspace *ws = workspace_by_frame(fr);
+    struct output *out = ws && ws->assigned_output ? ws->assigned_output :
+        active_output;
+    hook_request(HOOK_VIEW_UPDATE, out ? out->output_handle : 0);
+
+    // every change of the active frame or view ends with a redraw
+    layout_check_focus();
 }
 
 void frame_add(enum direction_t s) {
@@ -720,7 +865,7 @@ void frame_add(enum direction_t s) {
     fr->last_focused = fr->left;
 
     frame_redraw(fr, true);
-    wlc_output_schedule_render(active_output->output_handle);
+    layout_schedule_render(active_output->output_handle);
 
     if (debug_enabled) {
         print_frame_tree(active_output->active_ws->root_frame);
@@ -825,7 +970,7 @@ void frame_resize_percent(enum direction_t dir, float percent) {
 
     frame_recalc_geometries(resize_p, resize_p->border.g);
     frame_redraw(resize_p, true);
-    wlc_output_schedule_render(active_output->output_handle);
+    layout_schedule_render(active_output->output_handle);
 }
 
 void frame_delete() {
@@ -852,7 +997,7 @@ void frame_delete() {
 
         *fr->parent = *brother;
         active_output->active_ws->active_frame = fr->parent;
-        wlc_output_schedule_render(active_output->output_handle);
+        layout_schedule_render(active_output->output_handle);
 
         // the brother node might have never had a view attached
         if (!get_active_view()) {
@@ -864,6 +1009,8 @@ void frame_delete() {
         frame_redraw(fr->parent, true);
         wlc_view_focus(get_active_view());
 
+        focus_forget(fr);
+        focus_forget(brother);
         vector_free(fr->children);
         free(fr->border.buffer);
         free(fr);
@@ -891,10 +1038,12 @@ void frame_delete() {
         *fr->parent = *brother;
         active_output->active_ws->active_frame = new_leaf;
         frame_recalc_geometries(fr->parent, fr->parent->border.g);
-        wlc_output_schedule_render(active_output->output_handle);
+        layout_schedule_render(active_output->output_handle);
         frame_redraw(fr->parent, true);
         wlc_view_focus(get_active_view());
 
+        focus_forget(fr);
+        focus_forget(brother);
         vector_free(fr->children);
         free(fr->border.buffer);
         free(fr);
@@ -1219,7 +1368,7 @@ void focus_direction(enum direction_t dir) {
         fr->active_view = adj_view;
         wlc_view_focus(fr->active_view);
         frame_redraw(fr, false);
-        wlc_output_schedule_render(active_output->output_handle);
+        layout_schedule_render(active_output->output_handle);
         return;
     }
 
@@ -1230,7 +1379,7 @@ void focus_direction(enum direction_t dir) {
         adj_fr->parent->last_focused = adj_fr;
         frame_redraw(fr, false);
         frame_redraw(adj_fr, false);
-        wlc_output_schedule_render(active_output->output_handle);
+        layout_schedule_render(active_output->output_handle);
         wlc_view_focus(get_active_view());
     }
 }
@@ -1288,7 +1437,7 @@ void move_direction(enum direction_t dir) {
         active_output->active_ws->active_frame = adj_fr;
         frame_redraw(fr, false);
         child_add(v);
-        wlc_output_schedule_render(active_output->output_handle);
+        layout_schedule_render(active_output->output_handle);
     }
 }
 
@@ -1322,7 +1471,7 @@ void move_to_workspace(uint32_t num) {
 
     frame_redraw(fr, false);
     wlc_view_focus(next_view);
-    wlc_output_schedule_render(active_output->output_handle);
+    layout_schedule_render(active_output->output_handle);
 }
 
 void workspace_add() {
@@ -1330,8 +1479,8 @@ void workspace_add() {
     if (ws) {
         vector_add(workspaces, ws);
     }
-    update_bar(active_output);
-    wlc_output_schedule_render(active_output->output_handle);
+    layout_bar_repaint_all();
+    layout_schedule_render(active_output->output_handle);
 }
 
 // next: 1 := next, 0 := previous
@@ -1380,7 +1529,74 @@ void cycle_view_in_frame(uint32_t next) {
     fr->active_view = frame_get_view_i(fr, next_index);
     wlc_view_focus(fr->active_view);
     frame_redraw(fr, false);
-    wlc_output_schedule_render(active_output->output_handle);
+    layout_schedule_render(active_output->output_handle);
+}
+
+static void frame_clamp_tile(struct frame *fr) {
+    if (!fr) {
+        return;
+    }
+    if (fr->tile >= config->num_layouts) {
+        fr->tile = 0;
+    }
+    frame_clamp_tile(fr->left);
+    frame_clamp_tile(fr->right);
+}
+
+void layout_reconfigure() {
+    // the list of tiling layouts might have become shorter
+    for (uint32_t i = 0; i < workspaces->length; i++) {
+        struct workspace *ws = workspaces->items[i];
+        frame_clamp_tile(ws->root_frame);
+    }
+
+    for (uint32_t i = 0; i < outputs->length; i++) {
+        struct output *out = outputs->items[i];
+        const struct wlc_size *res =
+            wlc_output_get_virtual_resolution(out->output_handle);
+        output_update_resolution(out, res->w, res->h);
+    }
+}
+
+// redraws the border buffers of a frame tree with the current geometry of
+// the views
+static void frame_repaint_borders(struct frame *fr) {
+    if (!fr) {
+        return;
+    }
+    frame_repaint_borders(fr->left);
+    frame_repaint_borders(fr->right);
+    if (fr->split != SPLIT_NONE || !fr->border.buffer) {
+        return;
+    }
+
+    update_frame_border(fr, false);
+    uint32_t view_border = config->view_border_size;
+    for (uint32_t i = 0; i < fr->children->length; i++) {
+        wlc_handle v = frame_get_view_i(fr, i);
+        if (!wlc_view_get_mask(v)) {
+            continue; // hidden by the fullscreen layout
+        }
+
+        // the inverse of set_view
+        const struct wlc_geometry *g = wlc_view_get_geometry(v);
+        struct wlc_geometry g_border;
+        g_border.origin.x = g->origin.x - view_border -
+            fr->border.g_gaps.origin.x;
+        g_border.origin.y = g->origin.y - view_border -
+            fr->border.g_gaps.origin.y;
+        g_border.size.w = g->size.w + 2*view_border;
+        g_border.size.h = g->size.h + 2*view_border;
+        update_view_border(fr, v, &g_border);
+    }
+}
+
+void layout_repaint_borders() {
+    for (uint32_t i = 0; i < outputs->length; i++) {
+        struct output *out = outputs->items[i];
+        frame_repaint_borders(out->active_ws->root_frame);
+        layout_schedule_render(out->output_handle);
+    }
 }
 
 void free_all_outputs() {
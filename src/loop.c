@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <wlc/wlc.h>
+
+#include "loop.h"
+#include "log.h"
+#include "vector.h"
+
+struct loop_call_t {
+    void (*f)(void *data);
+    void *data;
+};
+
+// pending calls, protected by calls_lock
+static struct vector_t *calls = NULL;
+static pthread_mutex_t calls_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int wake_fd = -1;
+static struct wlc_event_source *wake_source = NULL;
+
+static pthread_t main_thread;
+static bool main_thread_set = false;
+
+static void loop_wake() {
+    uint64_t one = 1;
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0) {
+        wavy_log(LOG_ERROR, "Failed to wake up the main loop");
+    }
+}
+
+static int loop_dispatch(int fd, uint32_t mask, void *arg) {
+    (void) mask; (void) arg;
+
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0) {
+        return 0; // spurious wakeup, the counter was already reset
+    }
+
+    // take the whole queue, so calls that queue new calls don't starve the
+    // event loop. those are run on the next iteration.
+    pthread_mutex_lock(&calls_lock);
+    struct vector_t *pending = calls;
+    calls = NULL;
+    pthread_mutex_unlock(&calls_lock);
+
+    if (!pending) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < pending->length; i++) {
+        struct loop_call_t *c = pending->items[i];
+        c->f(c->data);
+        free(c);
+    }
+    vector_free(pending);
+    return 0;
+}
+
+void loop_call(void (*f)(void *data), void *data) {
+    struct loop_call_t *c = malloc(sizeof(struct loop_call_t));
+    if (!c) {
+        wavy_log(LOG_ERROR, "Failed to allocate main loop call");
+        return;
+    }
+    c->f = f;
+    c->data = data;
+
+    pthread_mutex_lock(&calls_lock);
+    if (!calls) {
+        calls = vector_init();
+    }
+    vector_add(calls, c);
+    pthread_mutex_unlock(&calls_lock);
+
+    loop_wake();
+}
+
+bool loop_is_main() {
+    return main_thread_set && pthread_equal(main_thread, pthread_self());
+}
+
+void init_loop() {
+    main_thread = pthread_self();
+    main_thread_set = true;
+
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0) {
+        wavy_log(LOG_ERROR, "Failed to create main loop eventfd");
+        exit(EXIT_FAILURE);
+    }
+
+    wake_source = wlc_event_loop_add_fd(wake_fd, WLC_EVENT_READABLE,
+            loop_dispatch, NULL);
+    if (!wake_source) {
+        wavy_log(LOG_ERROR, "Failed to register main loop eventfd");
+        exit(EXIT_FAILURE);
+    }
+
+    // calls might have been queued before the loop existed
+    loop_wake();
+}
+
+void free_loop() {
+    if (wake_source) {
+        wlc_event_source_remove(wake_source);
+        wake_source = NULL;
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+
+    pthread_mutex_lock(&calls_lock);
+    if (calls) {
+        for (uint32_t i = 0; i < calls->length; i++) {
+            free(calls->items[i]);
+        }
+        vector_free(calls);
+        calls = NULL;
+    }
+    pthread_mutex_unlock(&calls_lock);
+}
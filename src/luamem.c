@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "luacompat.h"
+#include "luamem.h"
+#include "log.h"
+#include "vector.h"
+
+#define LUAMEM_CHUNK (64 * 1024)
+#define LUAMEM_CLASSES 10
+#define LUAMEM_MAX_CLASS 512
+
+static const uint32_t class_sizes[LUAMEM_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512
+};
+
+struct free_block_t {
+    struct free_block_t *next;
+};
+
+// chunks are kept in a list, the header is padded to keep blocks aligned
+struct chunk_t {
+    struct chunk_t *next;
+    char pad[16 - sizeof(struct chunk_t *)];
+};
+
+struct luamem_pool_t {
+    struct free_block_t *free[LUAMEM_CLASSES];
+    struct chunk_t *chunks;
+    char *bump;         // unused rest of the newest chunk
+    size_t bump_left;
+
+    enum luamem_subsys_t home;    // subsystem of the state
+    enum luamem_subsys_t current; // subsystem allocations are counted for
+
+    // written by the owning thread, read by luamem_stats
+    size_t in_use;
+    uint64_t allocated[LUAMEM_SUBSYSTEMS];
+    uint64_t emergency_gcs;
+
+    bool ready;     // the state is built, lua can collect on failure
+    bool retrying;  // the last allocation failed because of the limit
+    bool collect;   // over the limit, see luamem_collect (LuaJIT only)
+    size_t trigger; // raised limit after an emergency collection
+};
+
+static size_t soft_limit = 0;
+
+// *luamem_pool_t's of all states
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct vector_t *pools = NULL;
+
+static int32_t class_index(size_t size) {
+    if (size > LUAMEM_MAX_CLASS) {
+        return -1;
+    }
+    int32_t i = 0;
+    while (class_sizes[i] < size) {
+        i++;
+    }
+    return i;
+}
+
+static void *pool_get(struct luamem_pool_t *p, int32_t c) {
+    struct free_block_t *b = p->free[c];
+    if (b) {
+        p->free[c] = b->next;
+        return b;
+    }
+
+    uint32_t size = class_sizes[c];
+    if (p->bump_left < size) {
+        struct chunk_t *chunk = malloc(LUAMEM_CHUNK);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = p->chunks;
+        p->chunks = chunk;
+        p->bump = (char *) (chunk + 1);
+        p->bump_left = LUAMEM_CHUNK - sizeof(struct chunk_t);
+    }
+    void *block = p->bump;
+    p->bump += size;
+    p->bump_left -= size;
+    return block;
+}
+
+static void pool_put(struct luamem_pool_t *p, int32_t c, void *block) {
+    struct free_block_t *b = block;
+    b->next = p->free[c];
+    p->free[c] = b;
+}
+
+static void account(struct luamem_pool_t *p, size_t old, size_t new) {
+    size_t in_use = p->in_use - old + new;
+    __atomic_store_n(&p->in_use, in_use, __ATOMIC_RELAXED);
+    if (new > old) {
+        __atomic_store_n(&p->allocated[p->current],
+                p->allocated[p->current] + new - old, __ATOMIC_RELAXED);
+    }
+    if (in_use < soft_limit / 2) {
+        p->trigger = 0;
+    }
+}
+
+// true if the allocation has to fail so lua collects garbage first
+static bool over_limit(struct luamem_pool_t *p, size_t old, size_t new) {
+    // lua retries a failed allocation right after its emergency collection,
+    // so the next allocation is that retry. it goes through, the next
+    // collection happens once the state grew by half again.
+    if (p->retrying) {
+        p->retrying = false;
+        p->trigger = p->in_use + p->in_use / 2;
+        __atomic_store_n(&p->emergency_gcs, p->emergency_gcs + 1,
+                __ATOMIC_RELAXED);
+        return false;
+    }
+
+    size_t trigger = p->trigger > soft_limit ? p->trigger : soft_limit;
+    if (!soft_limit || !p->ready || new <= old ||
+        p->in_use - old + new <= trigger) {
+        return false;
+    }
+#ifdef WAVY_LUAJIT
+    // LuaJIT raises an error on the first failed allocation instead of
+    // collecting and retrying, so luamem_collect does it after the callback
+    p->collect = true;
+    return false;
+#else
+    p->retrying = true;
+    return true;
+#endif
+}
+
+static void *luamem_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    struct luamem_pool_t *p = ud;
+    size_t old = ptr ? osize : 0; // osize is a type tag for new blocks
+    int32_t old_c = ptr ? class_index(osize) : -1;
+
+    if (nsize == 0) {
+        if (ptr) {
+            if (old_c >= 0) {
+                pool_put(p, old_c, ptr);
+            } else {
+                free(ptr);
+            }
+            account(p, old, 0);
+        }
+        return NULL;
+    }
+
+    if (over_limit(p, old, nsize)) {
+        return NULL;
+    }
+
+    int32_t new_c = class_index(nsize);
+    void *block;
+    if (ptr && old_c == new_c && new_c >= 0) {
+        block = ptr; // same size class
+    } else if (ptr && old_c < 0 && new_c < 0) {
+        block = realloc(ptr, nsize);
+        if (!block) {
+            return NULL;
+        }
+    } else {
+        block = new_c >= 0 ? pool_get(p, new_c) : malloc(nsize);
+        if (!block) {
+            return NULL;
+        }
+        if (ptr) {
+            memcpy(block, ptr, old < nsize ? old : nsize);
+            if (old_c >= 0) {
+                pool_put(p, old_c, ptr);
+            } else {
+                free(ptr);
+            }
+        }
+    }
+    account(p, old, nsize);
+    return block;
+}
+
+static int panic(lua_State *L) {
+    wavy_log(LOG_ERROR, "Unprotected error in lua: %s", lua_tostring(L, -1));
+    return 0;
+}
+
+static struct luamem_pool_t *get_pool(lua_State *L) {
+    return *(struct luamem_pool_t **) lua_getextraspace(L);
+}
+
+void luamem_collect(lua_State *L) {
+#ifdef WAVY_LUAJIT
+    struct luamem_pool_t *p = get_pool(L);
+    if (!p->collect) {
+        return;
+    }
+    p->collect = false;
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    p->trigger = p->in_use + p->in_use / 2;
+    __atomic_store_n(&p->emergency_gcs, p->emergency_gcs + 1,
+            __ATOMIC_RELAXED);
+#else
+    (void) L;
+#endif
+}
+
+lua_State *luamem_newstate(enum luamem_subsys_t subsys) {
+    struct luamem_pool_t *p = calloc(1, sizeof(struct luamem_pool_t));
+    if (!p) {
+        return NULL;
+    }
+    p->home = subsys;
+    p->current = subsys;
+
+    lua_State *L = lua_newstate(luamem_alloc, p);
+#ifdef WAVY_LUAJIT
+    // LuaJIT without GC64 only runs on its own allocator, the state is not
+    // accounted then
+    if (!L) {
+        L = luaL_newstate();
+    }
+#endif
+    if (!L) {
+        free(p);
+        return NULL;
+    }
+    lua_atpanic(L, panic);
+    *(struct luamem_pool_t **) lua_getextraspace(L) = p;
+    p->ready = true;
+
+    pthread_mutex_lock(&pools_lock);
+    if (!pools) {
+        pools = vector_init();
+    }
+    vector_add(pools, p);
+    pthread_mutex_unlock(&pools_lock);
+    return L;
+}
+
+void luamem_close(lua_State *L) {
+    struct luamem_pool_t *p = get_pool(L);
+    lua_close(L);
+
+    pthread_mutex_lock(&pools_lock);
+    for (uint32_t i = 0; pools && i < pools->length; i++) {
+        if (pools->items[i] == p) {
+            vector_del(pools, i);
+            break;
+        }
+    }
+    if (pools && pools->length == 0) {
+        vector_free(pools);
+        pools = NULL;
+    }
+    pthread_mutex_unlock(&pools_lock);
+
+    while (p->chunks) {
+        struct chunk_t *next = p->chunks->next;
+        free(p->chunks);
+        p->chunks = next;
+    }
+    free(p);
+}
+
+enum luamem_subsys_t luamem_set_subsys(lua_State *L,
+        enum luamem_subsys_t subsys) {
+
+    struct luamem_pool_t *p = get_pool(L);
+    enum luamem_subsys_t prev = p->current;
+    p->current = subsys;
+    return prev;
+}
+
+void luamem_set_limit(size_t bytes) {
+    soft_limit = bytes;
+}
+
+void luamem_stats(enum luamem_subsys_t subsys, struct luamem_stats_t *stats) {
+    memset(stats, 0, sizeof(struct luamem_stats_t));
+    pthread_mutex_lock(&pools_lock);
+    for (uint32_t i = 0; pools && i < pools->length; i++) {
+        struct luamem_pool_t *p = pools->items[i];
+        stats->allocated += __atomic_load_n(&p->allocated[subsys],
+                __ATOMIC_RELAXED);
+        if (p->home == subsys) {
+            stats->in_use += __atomic_load_n(&p->in_use, __ATOMIC_RELAXED);
+            stats->emergency_gcs += __atomic_load_n(&p->emergency_gcs,
+                    __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&pools_lock);
+}
+
+const char *luamem_subsys_str(enum luamem_subsys_t subsys) {
+    switch (subsys) {
+    case LUAMEM_CONFIG:
+        return "config";
+    case LUAMEM_WIDGETS:
+        return "widgets";
+    case LUAMEM_KEYBINDINGS:
+        return "keybindings";
+    default:
+        return "unknown";
+    }
+}
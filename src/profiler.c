@@ -0,0 +1,316 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <wlc/wlc.h>
+
+#include "luacompat.h"
+#include "profiler.h"
+#include "config.h"
+#include "bar.h"
+#include "loop.h"
+#include "log.h"
+#include "vector.h"
+
+// the allocator a lua_State had before profiler_attach
+struct profile_alloc_t {
+    lua_Alloc f;
+    void *ud;
+};
+
+struct profile_run_t {
+    struct profile_t *profile; // NULL if no callback runs
+    uint64_t start_ns;
+};
+
+static bool enabled = false; // atomic
+
+static pthread_mutex_t profiler_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// *profile_t's and *profile_alloc_t's, protected by the profiler lock
+static struct vector_t *profiles = NULL;
+static struct vector_t *allocs = NULL;
+
+static struct wlc_event_source *timer = NULL;
+
+// the callback running on this thread
+static __thread struct profile_run_t current;
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool profiler_enabled() {
+    return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+// (re)arms the periodic report, main loop only
+static void arm_timer(void *data) {
+    (void) data;
+    if (timer) {
+        uint32_t secs = config->profiler_interval;
+        wlc_event_source_timer_update(timer,
+                profiler_enabled() && secs ? secs * 1000 : 0);
+    }
+}
+
+void profiler_set_enabled(bool on) {
+    __atomic_store_n(&enabled, on, __ATOMIC_RELAXED);
+    loop_call(arm_timer, NULL);
+}
+
+static void profile_free(void *data) {
+    struct profile_t *p = data;
+    for (uint32_t i = 0; i < PROFILE_LINES; i++) {
+        free(p->lines[i].location);
+    }
+    free(p->location);
+    free(p);
+}
+
+struct profile_t *profiler_get(const char *kind, uint32_t id, lua_State *L,
+        int32_t ref) {
+
+    pthread_mutex_lock(&profiler_lock);
+    if (!profiles) {
+        profiles = vector_init();
+    }
+    for (uint32_t i = 0; i < profiles->length; i++) {
+        struct profile_t *p = profiles->items[i];
+        if (p->ref == id && !strcmp(p->kind, kind)) {
+            pthread_mutex_unlock(&profiler_lock);
+            return p;
+        }
+    }
+
+    struct profile_t *p = calloc(1, sizeof(struct profile_t));
+    if (!p) {
+        pthread_mutex_unlock(&profiler_lock);
+        wavy_log(LOG_ERROR, "Failed to allocate profile");
+        return NULL;
+    }
+    p->kind = kind;
+    p->ref = id;
+
+    lua_Debug ar;
+    char location[256] = "?";
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    if (lua_isfunction(L, -1) && lua_getinfo(L, ">S", &ar)) {
+        snprintf(location, sizeof(location), "%s:%d", ar.short_src,
+                ar.linedefined);
+    } else {
+        lua_pop(L, 1);
+    }
+    p->location = strdup(location);
+
+    vector_add(profiles, p);
+    pthread_mutex_unlock(&profiler_lock);
+    return p;
+}
+
+void profiler_begin(struct profile_t *p) {
+    current.profile = p;
+    current.start_ns = monotonic_ns();
+}
+
+void profiler_end() {
+    struct profile_t *p = current.profile;
+    if (!p) {
+        return;
+    }
+    current.profile = NULL;
+
+    uint64_t ns = monotonic_ns() - current.start_ns;
+    __atomic_add_fetch(&p->calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p->time_ns, ns, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&p->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&p->max_ns, &max, ns,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // another thread raised it, max was reloaded
+    }
+}
+
+// FNV-1a of the chunk name and the line
+static uint64_t line_key(const char *src, int line) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const char *c = src; *c; c++) {
+        h = (h ^ (unsigned char) *c) * 1099511628211ULL;
+    }
+    h = (h ^ (uint32_t) line) * 1099511628211ULL;
+    return h ? h : 1;
+}
+
+void profiler_sample(lua_State *L) {
+    struct profile_t *p = current.profile;
+    lua_Debug ar;
+    if (!p || !lua_getstack(L, 0, &ar) || !lua_getinfo(L, "Sl", &ar)) {
+        return;
+    }
+    __atomic_add_fetch(&p->samples, 1, __ATOMIC_RELAXED);
+
+    // samples are taken every few thousand instructions of every callback,
+    // so this only takes a lock-free slot and counts in it
+    uint64_t key = line_key(ar.short_src, ar.currentline);
+    for (uint32_t i = 0; i < PROFILE_LINES; i++) {
+        struct profile_line_t *l = &p->lines[(key + i) % PROFILE_LINES];
+        uint64_t k = __atomic_load_n(&l->key, __ATOMIC_ACQUIRE);
+        if (!k) {
+            if (__atomic_compare_exchange_n(&l->key, &k, key, false,
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                char location[256];
+                snprintf(location, sizeof(location), "%s:%d", ar.short_src,
+                        ar.currentline);
+                __atomic_store_n(&l->location, strdup(location),
+                        __ATOMIC_RELEASE);
+                k = key;
+            }
+        }
+        if (k == key) {
+            __atomic_add_fetch(&l->samples, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+static void *profiler_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    struct profile_alloc_t *a = ud;
+    struct profile_t *p = current.profile;
+
+    // osize is a type tag for new blocks
+    size_t old = ptr ? osize : 0;
+    if (p && nsize > old) {
+        __atomic_add_fetch(&p->allocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&p->alloc_bytes, nsize - old, __ATOMIC_RELAXED);
+    }
+    return a->f(a->ud, ptr, osize, nsize);
+}
+
+void profiler_attach(lua_State *L) {
+    struct profile_alloc_t *a = malloc(sizeof(struct profile_alloc_t));
+    if (!a) {
+        wavy_log(LOG_ERROR, "Failed to allocate profiler allocator");
+        return;
+    }
+    a->f = lua_getallocf(L, &a->ud);
+    lua_setallocf(L, profiler_alloc, a);
+
+    // freed in free_profiler, after all lua_States are closed
+    pthread_mutex_lock(&profiler_lock);
+    if (!allocs) {
+        allocs = vector_init();
+    }
+    vector_add(allocs, a);
+    pthread_mutex_unlock(&profiler_lock);
+}
+
+static int cmp_profiles(const void *a, const void *b) {
+    const struct profile_t *pa = *(struct profile_t * const *) a;
+    const struct profile_t *pb = *(struct profile_t * const *) b;
+    if (pa->time_ns != pb->time_ns) {
+        return pa->time_ns < pb->time_ns ? 1 : -1;
+    }
+    return 0;
+}
+
+char *profiler_report() {
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *f = open_memstream(&buf, &size);
+    if (!f) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&profiler_lock);
+    uint32_t n = profiles ? profiles->length : 0;
+    struct profile_t **sorted = calloc(n ? n : 1, sizeof(struct profile_t *));
+    if (sorted) {
+        for (uint32_t i = 0; i < n; i++) {
+            sorted[i] = profiles->items[i];
+        }
+        qsort(sorted, n, sizeof(struct profile_t *), cmp_profiles);
+    } else {
+        n = 0;
+    }
+
+    fprintf(f, "Lua callback profile (%u callbacks, sorted by time)\n", n);
+    fprintf(f, "%10s %8s %9s %9s %8s %9s %9s  %s\n", "total ms", "calls",
+            "avg us", "max us", "samples", "allocs", "KiB", "callback");
+    for (uint32_t i = 0; i < n; i++) {
+        struct profile_t *p = sorted[i];
+        uint64_t calls = p->calls;
+
+        // hottest line of the callback, a slot without a location is still
+        // being taken
+        const char *hot = NULL;
+        uint64_t hot_samples = 0;
+        for (uint32_t j = 0; j < PROFILE_LINES; j++) {
+            struct profile_line_t *l = &p->lines[j];
+            const char *location = __atomic_load_n(&l->location,
+                    __ATOMIC_ACQUIRE);
+            uint64_t samples = __atomic_load_n(&l->samples, __ATOMIC_RELAXED);
+            if (location && samples > hot_samples) {
+                hot = location;
+                hot_samples = samples;
+            }
+        }
+
+        fprintf(f, "%10.1f %8" PRIu64 " %9.1f %9.1f %8" PRIu64 " %9" PRIu64
+                " %9" PRIu64 "  %s %u (%s)",
+                p->time_ns / 1e6, calls,
+                calls ? p->time_ns / 1e3 / calls : 0.0, p->max_ns / 1e3,
+                p->samples, p->allocs, p->alloc_bytes / 1024, p->kind, p->ref,
+                p->location);
+        if (hot) {
+            fprintf(f, " hot: %s", hot);
+        }
+        fputc('\n', f);
+    }
+    pthread_mutex_unlock(&profiler_lock);
+
+    free(sorted);
+    fclose(f);
+    return buf;
+}
+
+static int report_tick(void *arg) {
+    (void) arg;
+    char *report = profiler_report();
+    if (report) {
+        wavy_log(LOG_WAVY, "%s", report);
+        free(report);
+    }
+    arm_timer(NULL);
+    return 0;
+}
+
+void init_profiler() {
+    timer = wlc_event_loop_add_timer(report_tick, NULL);
+    if (!timer) {
+        wavy_log(LOG_ERROR, "Failed to create profiler timer");
+        return;
+    }
+    arm_timer(NULL);
+}
+
+void free_profiler() {
+    if (timer) {
+        wlc_event_source_remove(timer);
+        timer = NULL;
+    }
+    if (profiles) {
+        vector_foreach(profiles, profile_free);
+        vector_free(profiles);
+        profiles = NULL;
+    }
+    if (allocs) {
+        vector_foreach(allocs, free);
+        vector_free(allocs);
+        allocs = NULL;
+    }
+}
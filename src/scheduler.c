@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <wlc/wlc.h>
+
+#include "scheduler.h"
+#include "bar.h"
+#include "workers.h"
+#include "layout.h"
+#include "log.h"
+#include "utils.h"
+#include "vector.h"
+
+// non-aligned widgets that are due within this window are pulled forward and
+// run together with the widgets that are due now
+#define SCHED_SLACK_MS 50
+
+// aligned widgets fire slightly after the boundary, so a clock never reads
+// the previous minute
+#define SCHED_ALIGN_MARGIN_MS 5
+
+static struct wlc_event_source *timer = NULL;
+
+// while every output is asleep the timer isn't armed, the widgets that were
+// due in the meantime (*status_entry_t's) run when an output wakes up
+static bool sleeping = false;
+static struct vector_t *missed = NULL;
+
+// milliseconds since the epoch in local time, so daily intervals align to
+// local midnight
+static int64_t local_realtime_ms() {
+    struct timespec ts;
+    struct tm tm;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localtime_r(&ts.tv_sec, &tm);
+    return ((int64_t) ts.tv_sec + tm.tm_gmtoff) * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool is_periodic(struct status_entry_t *e) {
+    return e->hook == HOOK_PERIODIC_FAST || e->hook == HOOK_PERIODIC_SLOW ||
+           e->hook == HOOK_PERIODIC;
+}
+
+static void set_next_deadline(struct status_entry_t *e, int64_t now) {
+    if (e->align) {
+        // recalculated from the wall clock every time, so clock changes
+        // (ntp, timezone) are picked up on the next tick
+        int64_t real = local_realtime_ms();
+        int64_t next_real = (real / e->interval_ms + 1) * e->interval_ms;
+        e->next_ms = now + (next_real - real) + SCHED_ALIGN_MARGIN_MS;
+    } else {
+        // advance from the previous deadline instead of 'now', so the
+        // interval doesn't drift. skip ticks that were missed (e.g. suspend).
+        e->next_ms += e->interval_ms;
+        if (e->next_ms <= now) {
+            e->next_ms = now + e->interval_ms;
+        }
+    }
+}
+
+// true if every output is in dpms sleep, nobody can see the bar then
+static bool all_outputs_asleep() {
+    struct vector_t *outs = get_outputs();
+    if (outs->length == 0) {
+        return false;
+    }
+    for (uint32_t i = 0; i < outs->length; i++) {
+        struct output *out = outs->items[i];
+        if (!wlc_output_get_sleep(out->output_handle)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void add_missed(struct vector_t *batch) {
+    if (!missed) {
+        missed = vector_init();
+    }
+    for (uint32_t i = 0; i < batch->length; i++) {
+        bool found = false;
+        for (uint32_t j = 0; j < missed->length && !found; j++) {
+            found = missed->items[j] == batch->items[i];
+        }
+        if (!found) {
+            vector_add(missed, batch->items[i]);
+        }
+    }
+}
+
+static int scheduler_tick(void *arg) {
+    (void) arg;
+
+    struct vector_t *widgets = get_widgets();
+    struct vector_t *batch = vector_init();
+    int64_t now = monotonic_ms();
+    int64_t earliest = INT64_MAX;
+
+    for (uint32_t i = 0; i < widgets->length; i++) {
+        struct status_entry_t *e = widgets->items[i];
+        if (!is_periodic(e)) {
+            continue;
+        }
+
+        // the first deadline is 0, the widget thread already updates every
+        // widget on startup
+        if (e->next_ms == 0) {
+            e->next_ms = now;
+            set_next_deadline(e, now);
+        } else if (e->next_ms <= now ||
+                   (!e->align && e->next_ms <= now + SCHED_SLACK_MS)) {
+            vector_add(batch, e);
+            set_next_deadline(e, now);
+        }
+
+        if (e->next_ms < earliest) {
+            earliest = e->next_ms;
+        }
+    }
+
+    if (all_outputs_asleep()) {
+        add_missed(batch);
+        vector_free(batch);
+        sleeping = true;
+        return 0;
+    }
+
+    if (batch->length > 0) {
+        // widgets with precomputed content show it right away, their
+        // callbacks still run to pick up anything unexpected
+        bool precomputed = false;
+        for (uint32_t i = 0; i < batch->length; i++) {
+            struct status_entry_t *e = batch->items[i];
+            precomputed |= e->precompute;
+        }
+        if (precomputed) {
+            bar_commit_staged((struct status_entry_t **) batch->items,
+                    batch->length);
+        }
+        queue_widgets((struct status_entry_t **) batch->items, batch->length);
+    }
+    vector_free(batch);
+
+    if (earliest != INT64_MAX) {
+        int64_t delay = earliest - now;
+        wlc_event_source_timer_update(timer, delay > 0 ? delay : 1);
+    }
+    return 0;
+}
+
+int64_t scheduler_next_tick(struct status_entry_t *e) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t real = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    if (!e->align) {
+        return real + e->interval_ms;
+    }
+
+    // aligned to local time, like set_next_deadline
+    int64_t local = local_realtime_ms();
+    int64_t next_local = (local / e->interval_ms + 1) * e->interval_ms;
+    return real + (next_local - local);
+}
+
+void scheduler_wake() {
+    if (!sleeping || !timer) {
+        return;
+    }
+    sleeping = false;
+
+    // the staged content of precomputed widgets is outdated by now, so they
+    // only run again
+    if (missed) {
+        queue_widgets((struct status_entry_t **) missed->items,
+                missed->length);
+        vector_free(missed);
+        missed = NULL;
+    }
+    scheduler_tick(NULL);
+}
+
+void init_scheduler() {
+    timer = wlc_event_loop_add_timer(scheduler_tick, NULL);
+    if (!timer) {
+        wavy_log(LOG_ERROR, "Failed to create widget timer");
+        return;
+    }
+
+    // calculates the first deadlines and arms the timer
+    scheduler_tick(NULL);
+}
+
+void free_scheduler() {
+    if (timer) {
+        wlc_event_source_remove(timer);
+        timer = NULL;
+    }
+    if (missed) {
+        vector_free(missed);
+        missed = NULL;
+    }
+    sleeping = false;
+}
@@ -0,0 +1,563 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <wlc/wlc.h>
+
+#include "snapshot.h"
+#include "layout.h"
+#include "config.h"
+#include "log.h"
+#include "loop.h"
+#include "vector.h"
+
+#define SNAPSHOT_MT "wavy.snapshot"
+#define SNAPSHOT_CACHE "wavy.layout" // last get_layout() result of a state
+
+// what a userdata refers to. lists are indexed with 1..n.
+enum snap_kind_t {
+    SNAP_ROOT,
+    SNAP_OUTPUTS,
+    SNAP_WORKSPACES,
+    SNAP_VIEWS,     // tiled views of a frame
+    SNAP_FLOATING,  // floating views of a workspace
+    SNAP_OUTPUT,
+    SNAP_WORKSPACE,
+    SNAP_FRAME,
+    SNAP_VIEW
+};
+
+struct snap_ref_t {
+    struct snapshot_t *s; // holds a reference, NULL until it is set up
+    enum snap_kind_t kind;
+    int32_t idx;
+};
+
+static bool dirty = true; // main loop only
+static bool flush_queued = false;
+static uint64_t serial = 0;
+
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct snapshot_t *current = NULL;
+
+static void *snap_calloc(size_t size) {
+    void *p = calloc(1, size);
+    if (!p) {
+        wavy_log(LOG_ERROR, "Failed to allocate layout snapshot");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static char *snap_strdup(const char *str) {
+    char *copy = strdup(str ? str : "");
+    if (!copy) {
+        wavy_log(LOG_ERROR, "Failed to allocate layout snapshot");
+        exit(EXIT_FAILURE);
+    }
+    return copy;
+}
+
+static int32_t index_of(struct vector_t *vec, void *item) {
+    for (uint32_t i = 0; item && i < vec->length; i++) {
+        if (vec->items[i] == item) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int32_t add_view(struct snapshot_t *s, wlc_handle view, int32_t ws,
+        int32_t frame) {
+
+    struct snap_view_t *v = snap_calloc(sizeof(struct snap_view_t));
+    v->handle = view;
+    v->title = snap_strdup(wlc_view_get_title(view));
+    v->app_id = snap_strdup(wlc_view_get_app_id(view));
+    v->class = snap_strdup(wlc_view_get_class(view));
+    const struct wlc_geometry *g = wlc_view_get_geometry(view);
+    if (g) {
+        v->g = *g;
+    }
+    v->workspace = ws;
+    v->frame = frame;
+    v->floating = frame < 0;
+    vector_add(s->views, v);
+    return s->views->length - 1;
+}
+
+// adds the frame tree of workspace ws in pre-order, returns the index of fr
+static int32_t add_frame(struct snapshot_t *s, struct frame *fr,
+        int32_t parent, int32_t ws) {
+
+    if (!fr) {
+        return -1;
+    }
+    struct snap_frame_t *f = snap_calloc(sizeof(struct snap_frame_t));
+    int32_t idx = s->frames->length;
+    vector_add(s->frames, f);
+
+    struct snap_workspace_t *w = s->workspaces->items[ws];
+    struct workspace *live = get_workspaces()->items[ws];
+    if (fr == live->active_frame) {
+        w->active_frame = idx;
+    }
+
+    f->split = fr->split;
+    f->symbol = config->tile_layout_strs[fr->tile];
+    f->workspace = ws;
+    f->parent = parent;
+    f->g = fr->border.g;
+    f->active_view = -1;
+    f->view_first = s->views->length;
+    for (uint32_t i = 0; fr->children && i < fr->children->length; i++) {
+        wlc_handle view = *((wlc_handle *) fr->children->items[i]);
+        int32_t v = add_view(s, view, ws, idx);
+        if (view == fr->active_view) {
+            f->active_view = v;
+        }
+    }
+    f->view_count = s->views->length - f->view_first;
+    f->left = add_frame(s, fr->left, idx, ws);
+    f->right = add_frame(s, fr->right, idx, ws);
+    return idx;
+}
+
+static struct snapshot_t *snapshot_build() {
+    struct vector_t *outputs = get_outputs();
+    struct vector_t *workspaces = get_workspaces();
+    struct workspace *active_ws = get_active_ws();
+    wlc_handle active_view = get_active_view();
+
+    struct snapshot_t *s = snap_calloc(sizeof(struct snapshot_t));
+    s->refs = 1;
+    s->serial = ++serial;
+    s->outputs = vector_init();
+    s->workspaces = vector_init();
+    s->frames = vector_init();
+    s->views = vector_init();
+    s->active_output = -1;
+    s->active_frame = -1;
+    s->active_view = -1;
+    s->active_workspace = index_of(workspaces, active_ws);
+
+    for (uint32_t i = 0; i < outputs->length; i++) {
+        struct output *out = outputs->items[i];
+        struct snap_output_t *o = snap_calloc(sizeof(struct snap_output_t));
+        o->handle = out->output_handle;
+        o->g = out->g;
+        o->workspace = index_of(workspaces, out->active_ws);
+        if (active_ws && out->active_ws == active_ws) {
+            s->active_output = i;
+        }
+        vector_add(s->outputs, o);
+    }
+
+    for (uint32_t i = 0; i < workspaces->length; i++) {
+        struct workspace *ws = workspaces->items[i];
+        struct snap_workspace_t *w =
+            snap_calloc(sizeof(struct snap_workspace_t));
+        vector_add(s->workspaces, w);
+
+        w->number = ws->number;
+        w->visible = ws->is_visible;
+        w->output = index_of(outputs, ws->assigned_output);
+        w->active_frame = -1;
+
+        w->root = add_frame(s, ws->root_frame, -1, i);
+
+        w->floating_first = s->views->length;
+        for (uint32_t j = 0; j < ws->floating_views->length; j++) {
+            wlc_handle v = *((wlc_handle *) ws->floating_views->items[j]);
+            add_view(s, v, i, -1);
+        }
+        w->floating_count = s->views->length - w->floating_first;
+
+        if (ws == active_ws) {
+            s->active_frame = w->active_frame;
+        }
+    }
+
+    for (uint32_t i = 0; active_view && i < s->views->length; i++) {
+        struct snap_view_t *v = s->views->items[i];
+        if (v->handle == active_view) {
+            s->active_view = i;
+            break;
+        }
+    }
+    return s;
+}
+
+static void view_free(void *data) {
+    struct snap_view_t *v = data;
+    free(v->title);
+    free(v->app_id);
+    free(v->class);
+    free(v);
+}
+
+void snapshot_release(struct snapshot_t *s) {
+    if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    vector_foreach(s->outputs, free);
+    vector_foreach(s->workspaces, free);
+    vector_foreach(s->frames, free);
+    vector_foreach(s->views, view_free);
+    vector_free(s->outputs);
+    vector_free(s->workspaces);
+    vector_free(s->frames);
+    vector_free(s->views);
+    free(s);
+}
+
+static void flush_queued_snapshot(void *data) {
+    (void) data;
+    flush_queued = false;
+    snapshot_flush();
+}
+
+// not every change is followed by a hook or an event (e.g. a bar repaint),
+// periodic widgets would read an old snapshot until one comes along
+void snapshot_invalidate() {
+    dirty = true;
+    if (!flush_queued) {
+        flush_queued = true;
+        loop_call(flush_queued_snapshot, NULL);
+    }
+}
+
+void snapshot_flush() {
+    if (!dirty || !get_outputs() || !get_workspaces()) {
+        return;
+    }
+    dirty = false;
+
+    struct snapshot_t *s = snapshot_build();
+    pthread_mutex_lock(&snapshot_lock);
+    struct snapshot_t *old = current;
+    current = s;
+    pthread_mutex_unlock(&snapshot_lock);
+    if (old) {
+        snapshot_release(old);
+    }
+}
+
+struct snapshot_t *snapshot_acquire() {
+    pthread_mutex_lock(&snapshot_lock);
+    struct snapshot_t *s = current;
+    if (s) {
+        __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+    return s;
+}
+
+struct snap_frame_t *snapshot_output_frame(struct snapshot_t *s,
+        wlc_handle output) {
+
+    int32_t frame = s->active_frame;
+    if (output) {
+        frame = -1;
+        for (uint32_t i = 0; i < s->outputs->length; i++) {
+            struct snap_output_t *o = s->outputs->items[i];
+            if (o->handle == output && o->workspace >= 0) {
+                struct snap_workspace_t *w = s->workspaces->items[o->workspace];
+                frame = w->active_frame;
+                break;
+            }
+        }
+    }
+    return frame >= 0 ? s->frames->items[frame] : NULL;
+}
+
+static int ref_gc(lua_State *L) {
+    struct snap_ref_t *r = lua_touserdata(L, 1);
+    if (r->s) {
+        snapshot_release(r->s);
+        r->s = NULL;
+    }
+    return 0;
+}
+
+static bool list_range(struct snap_ref_t *r, uint32_t *first,
+        uint32_t *count) {
+
+    struct snapshot_t *s = r->s;
+    *first = 0;
+    switch (r->kind) {
+    case SNAP_OUTPUTS:
+        *count = s->outputs->length;
+        return true;
+    case SNAP_WORKSPACES:
+        *count = s->workspaces->length;
+        return true;
+    case SNAP_VIEWS: {
+        struct snap_frame_t *f = s->frames->items[r->idx];
+        *first = f->view_first;
+        *count = f->view_count;
+        return true;
+    }
+    case SNAP_FLOATING: {
+        struct snap_workspace_t *w = s->workspaces->items[r->idx];
+        *first = w->floating_first;
+        *count = w->floating_count;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+static int ref_len(lua_State *L) {
+    struct snap_ref_t *r = luaL_checkudata(L, 1, SNAPSHOT_MT);
+    uint32_t first, count = 0;
+    list_range(r, &first, &count);
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+static int ref_index(lua_State *L);
+
+// creates a userdata that doesn't refer to a snapshot yet
+static struct snap_ref_t *new_ref(lua_State *L, enum snap_kind_t kind,
+        int32_t idx) {
+
+    struct snap_ref_t *r = lua_newuserdata(L, sizeof(struct snap_ref_t));
+    r->s = NULL;
+    r->kind = kind;
+    r->idx = idx;
+    if (luaL_newmetatable(L, SNAPSHOT_MT)) {
+        lua_pushcfunction(L, ref_index);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, ref_len);
+        lua_setfield(L, -2, "__len");
+        lua_pushcfunction(L, ref_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+    return r;
+}
+
+// pushes nil for idx -1
+static void push_ref(lua_State *L, struct snapshot_t *s,
+        enum snap_kind_t kind, int32_t idx) {
+
+    if (idx < 0) {
+        lua_pushnil(L);
+        return;
+    }
+    struct snap_ref_t *r = new_ref(L, kind, idx);
+    __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    r->s = s;
+}
+
+static bool push_geometry(lua_State *L, const char *key,
+        const struct wlc_geometry *g) {
+
+    if (!strcmp(key, "x")) {
+        lua_pushinteger(L, g->origin.x);
+    } else if (!strcmp(key, "y")) {
+        lua_pushinteger(L, g->origin.y);
+    } else if (!strcmp(key, "width")) {
+        lua_pushinteger(L, g->size.w);
+    } else if (!strcmp(key, "height")) {
+        lua_pushinteger(L, g->size.h);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static const char *split_str(enum frame_split_t split) {
+    switch (split) {
+    case SPLIT_HORIZONTAL:
+        return "horizontal";
+    case SPLIT_VERTICAL:
+        return "vertical";
+    default:
+        return "none";
+    }
+}
+
+static void index_root(lua_State *L, struct snapshot_t *s, const char *key) {
+    if (!strcmp(key, "serial")) {
+        lua_pushinteger(L, s->serial);
+    } else if (!strcmp(key, "outputs")) {
+        push_ref(L, s, SNAP_OUTPUTS, 0);
+    } else if (!strcmp(key, "workspaces")) {
+        push_ref(L, s, SNAP_WORKSPACES, 0);
+    } else if (!strcmp(key, "output")) {
+        push_ref(L, s, SNAP_OUTPUT, s->active_output);
+    } else if (!strcmp(key, "workspace")) {
+        push_ref(L, s, SNAP_WORKSPACE, s->active_workspace);
+    } else if (!strcmp(key, "frame")) {
+        push_ref(L, s, SNAP_FRAME, s->active_frame);
+    } else if (!strcmp(key, "view")) {
+        push_ref(L, s, SNAP_VIEW, s->active_view);
+    } else {
+        lua_pushnil(L);
+    }
+}
+
+static void index_output(lua_State *L, struct snapshot_t *s,
+        struct snap_output_t *o, const char *key) {
+
+    if (!strcmp(key, "handle")) {
+        lua_pushinteger(L, o->handle);
+    } else if (!strcmp(key, "workspace")) {
+        push_ref(L, s, SNAP_WORKSPACE, o->workspace);
+    } else if (!push_geometry(L, key, &o->g)) {
+        lua_pushnil(L);
+    }
+}
+
+static void index_workspace(lua_State *L, struct snapshot_t *s,
+        struct snap_workspace_t *w, int32_t idx, const char *key) {
+
+    if (!strcmp(key, "number")) {
+        lua_pushinteger(L, w->number);
+    } else if (!strcmp(key, "visible")) {
+        lua_pushboolean(L, w->visible);
+    } else if (!strcmp(key, "output")) {
+        push_ref(L, s, SNAP_OUTPUT, w->output);
+    } else if (!strcmp(key, "root")) {
+        push_ref(L, s, SNAP_FRAME, w->root);
+    } else if (!strcmp(key, "frame")) {
+        push_ref(L, s, SNAP_FRAME, w->active_frame);
+    } else if (!strcmp(key, "floating")) {
+        push_ref(L, s, SNAP_FLOATING, idx);
+    } else {
+        lua_pushnil(L);
+    }
+}
+
+static void index_frame(lua_State *L, struct snapshot_t *s,
+        struct snap_frame_t *f, int32_t idx, const char *key) {
+
+    if (!strcmp(key, "split")) {
+        lua_pushstring(L, split_str(f->split));
+    } else if (!strcmp(key, "layout")) {
+        lua_pushstring(L, f->symbol ? f->symbol : "");
+    } else if (!strcmp(key, "workspace")) {
+        push_ref(L, s, SNAP_WORKSPACE, f->workspace);
+    } else if (!strcmp(key, "parent")) {
+        push_ref(L, s, SNAP_FRAME, f->parent);
+    } else if (!strcmp(key, "left")) {
+        push_ref(L, s, SNAP_FRAME, f->left);
+    } else if (!strcmp(key, "right")) {
+        push_ref(L, s, SNAP_FRAME, f->right);
+    } else if (!strcmp(key, "views")) {
+        push_ref(L, s, SNAP_VIEWS, idx);
+    } else if (!strcmp(key, "view")) {
+        push_ref(L, s, SNAP_VIEW, f->active_view);
+    } else if (!push_geometry(L, key, &f->g)) {
+        lua_pushnil(L);
+    }
+}
+
+static void index_view(lua_State *L, struct snapshot_t *s,
+        struct snap_view_t *v, int32_t idx, const char *key) {
+
+    if (!strcmp(key, "handle")) {
+        lua_pushinteger(L, v->handle);
+    } else if (!strcmp(key, "title")) {
+        lua_pushstring(L, v->title);
+    } else if (!strcmp(key, "app_id")) {
+        lua_pushstring(L, v->app_id);
+    } else if (!strcmp(key, "class")) {
+        lua_pushstring(L, v->class);
+    } else if (!strcmp(key, "workspace")) {
+        push_ref(L, s, SNAP_WORKSPACE, v->workspace);
+    } else if (!strcmp(key, "frame")) {
+        push_ref(L, s, SNAP_FRAME, v->frame);
+    } else if (!strcmp(key, "floating")) {
+        lua_pushboolean(L, v->floating);
+    } else if (!strcmp(key, "focused")) {
+        lua_pushboolean(L, idx == s->active_view);
+    } else if (!push_geometry(L, key, &v->g)) {
+        lua_pushnil(L);
+    }
+}
+
+static int ref_index(lua_State *L) {
+    struct snap_ref_t *r = luaL_checkudata(L, 1, SNAPSHOT_MT);
+    struct snapshot_t *s = r->s;
+    if (!s) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    uint32_t first, count;
+    if (list_range(r, &first, &count)) {
+        lua_Integer i = lua_isinteger(L, 2) ? lua_tointeger(L, 2) : 0;
+        if (i < 1 || i > count) {
+            lua_pushnil(L);
+        } else if (r->kind == SNAP_OUTPUTS) {
+            push_ref(L, s, SNAP_OUTPUT, i - 1);
+        } else if (r->kind == SNAP_WORKSPACES) {
+            push_ref(L, s, SNAP_WORKSPACE, i - 1);
+        } else {
+            push_ref(L, s, SNAP_VIEW, first + i - 1);
+        }
+        return 1;
+    }
+
+    const char *key = lua_type(L, 2) == LUA_TSTRING ? lua_tostring(L, 2) : "";
+    switch (r->kind) {
+    case SNAP_ROOT:
+        index_root(L, s, key);
+        break;
+    case SNAP_OUTPUT:
+        index_output(L, s, s->outputs->items[r->idx], key);
+        break;
+    case SNAP_WORKSPACE:
+        index_workspace(L, s, s->workspaces->items[r->idx], r->idx, key);
+        break;
+    case SNAP_FRAME:
+        index_frame(L, s, s->frames->items[r->idx], r->idx, key);
+        break;
+    case SNAP_VIEW:
+        index_view(L, s, s->views->items[r->idx], r->idx, key);
+        break;
+    default:
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int snapshot_get_layout(lua_State *L) {
+    // a state keeps getting the same userdata while the snapshot is current
+    if (lua_getfield(L, LUA_REGISTRYINDEX, SNAPSHOT_CACHE) == LUA_TUSERDATA) {
+        struct snap_ref_t *r = lua_touserdata(L, -1);
+        pthread_mutex_lock(&snapshot_lock);
+        bool fresh = r->s == current;
+        pthread_mutex_unlock(&snapshot_lock);
+        if (fresh) {
+            return 1;
+        }
+    }
+    lua_pop(L, 1);
+
+    struct snap_ref_t *r = new_ref(L, SNAP_ROOT, 0);
+    r->s = snapshot_acquire();
+    if (!r->s) {
+        lua_pop(L, 1);
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, SNAPSHOT_CACHE);
+    return 1;
+}
+
+void free_snapshot() {
+    pthread_mutex_lock(&snapshot_lock);
+    struct snapshot_t *s = current;
+    current = NULL;
+    pthread_mutex_unlock(&snapshot_lock);
+    if (s) {
+        snapshot_release(s);
+    }
+}
@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <wlc/wlc.h>
+
+#include "sources.h"
+#include "bar.h"
+#include "workers.h"
+#include "log.h"
+#include "vector.h"
+
+struct file_watch_t {
+    int wd;
+    struct status_entry_t *e;
+};
+
+static int route_fd = -1;
+static int uevent_fd = -1;
+static int inotify_fd = -1;
+static struct wlc_event_source *route_src = NULL;
+static struct wlc_event_source *uevent_src = NULL;
+static struct wlc_event_source *inotify_src = NULL;
+
+// *file_watch_t's
+static struct vector_t *file_watches = NULL;
+
+bool widget_watch(struct status_entry_t *e, const char *source) {
+    if (!strcmp(source, "net")) {
+        e->watch |= SOURCE_NET;
+    } else if (!strcmp(source, "power_supply")) {
+        e->watch |= SOURCE_POWER_SUPPLY;
+    } else if (!strcmp(source, "backlight")) {
+        e->watch |= SOURCE_BACKLIGHT;
+    } else if (source[0] == '/') {
+        if (!e->watch_files) {
+            e->watch_files = vector_init();
+        }
+        vector_add(e->watch_files, strdup(source));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// queues every widget watching one of the sources in the mask
+static void fire_sources(uint32_t mask) {
+    struct vector_t *widgets = get_widgets();
+    struct vector_t *batch = vector_init();
+    for (uint32_t i = 0; i < widgets->length; i++) {
+        struct status_entry_t *e = widgets->items[i];
+        if (e->watch & mask) {
+            vector_add(batch, e);
+        }
+    }
+    queue_widgets((struct status_entry_t **) batch->items, batch->length);
+    vector_free(batch);
+}
+
+static int route_readable(int fd, uint32_t mask, void *arg) {
+    (void) mask;
+    (void) arg;
+
+    // the content doesn't matter, any link or address message means the
+    // network widgets should look again. drain the socket, so a burst of
+    // messages only queues the widgets once.
+    char buf[8192];
+    bool fire = false;
+    ssize_t len;
+    while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        struct nlmsghdr *nh = (struct nlmsghdr *) buf;
+        int32_t left = len;
+        for (; NLMSG_OK(nh, left); nh = NLMSG_NEXT(nh, left)) {
+            switch (nh->nlmsg_type) {
+                case RTM_NEWLINK:
+                case RTM_DELLINK:
+                case RTM_NEWADDR:
+                case RTM_DELADDR:
+                    fire = true;
+                    break;
+            }
+        }
+    }
+    if (len < 0 && errno == ENOBUFS) {
+        // messages were dropped, better look again
+        fire = true;
+    }
+
+    if (fire) {
+        fire_sources(SOURCE_NET);
+    }
+    return 0;
+}
+
+// a uevent is "action@devpath" followed by KEY=VALUE pairs, all separated
+// by null bytes
+static uint32_t uevent_source(const char *msg, size_t len) {
+    size_t i = strnlen(msg, len) + 1;
+    while (i < len) {
+        const char *kv = msg + i;
+        if (!strncmp(kv, "SUBSYSTEM=", 10)) {
+            if (!strcmp(kv + 10, "power_supply")) {
+                return SOURCE_POWER_SUPPLY;
+            } else if (!strcmp(kv + 10, "backlight")) {
+                return SOURCE_BACKLIGHT;
+            }
+            return 0;
+        }
+        i += strnlen(kv, len - i) + 1;
+    }
+    return 0;
+}
+
+static int uevent_readable(int fd, uint32_t mask, void *arg) {
+    (void) mask;
+    (void) arg;
+
+    char buf[4096];
+    uint32_t fired = 0;
+    ssize_t len;
+    while ((len = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0) {
+        buf[len] = 0;
+        fired |= uevent_source(buf, len);
+    }
+
+    if (fired) {
+        fire_sources(fired);
+    }
+    return 0;
+}
+
+static int inotify_readable(int fd, uint32_t mask, void *arg) {
+    (void) mask;
+    (void) arg;
+
+    char buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct vector_t *batch = vector_init();
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len;) {
+            struct inotify_event *ev = (struct inotify_event *) p;
+            for (uint32_t i = 0; i < file_watches->length; i++) {
+                struct file_watch_t *w = file_watches->items[i];
+                if (w->wd == ev->wd) {
+                    vector_add(batch, w->e);
+                }
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    // duplicates are skipped by queue_widgets
+    queue_widgets((struct status_entry_t **) batch->items, batch->length);
+    vector_free(batch);
+    return 0;
+}
+
+static int open_netlink(int protocol, uint32_t groups) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            protocol);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = groups;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void add_file_watches(struct status_entry_t *e) {
+    if (inotify_fd < 0) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0) {
+            wavy_log(LOG_ERROR, "Failed to initialize inotify");
+            return;
+        }
+        file_watches = vector_init();
+        inotify_src = wlc_event_loop_add_fd(inotify_fd, WLC_EVENT_READABLE,
+                inotify_readable, NULL);
+    }
+
+    for (uint32_t i = 0; i < e->watch_files->length; i++) {
+        char *path = e->watch_files->items[i];
+        int wd = inotify_add_watch(inotify_fd, path,
+                IN_MODIFY | IN_CLOSE_WRITE);
+        if (wd < 0) {
+            wavy_log(LOG_ERROR, "Failed to watch file %s", path);
+            continue;
+        }
+
+        struct file_watch_t *w = malloc(sizeof(struct file_watch_t));
+        if (!w) {
+            continue;
+        }
+        w->wd = wd;
+        w->e = e;
+        vector_add(file_watches, w);
+    }
+}
+
+void init_sources() {
+    struct vector_t *widgets = get_widgets();
+    uint32_t watched = 0;
+
+    for (uint32_t i = 0; i < widgets->length; i++) {
+        struct status_entry_t *e = widgets->items[i];
+        watched |= e->watch;
+        if (e->watch_files) {
+            add_file_watches(e);
+        }
+    }
+
+    if (watched & SOURCE_NET) {
+        route_fd = open_netlink(NETLINK_ROUTE,
+                RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR);
+        if (route_fd >= 0) {
+            route_src = wlc_event_loop_add_fd(route_fd, WLC_EVENT_READABLE,
+                    route_readable, NULL);
+        } else {
+            wavy_log(LOG_ERROR, "Failed to open rtnetlink socket");
+        }
+    }
+
+    // kernel uevents (multicast group 1), no need for udev itself
+    if (watched & (SOURCE_POWER_SUPPLY | SOURCE_BACKLIGHT)) {
+        uevent_fd = open_netlink(NETLINK_KOBJECT_UEVENT, 1);
+        if (uevent_fd >= 0) {
+            uevent_src = wlc_event_loop_add_fd(uevent_fd, WLC_EVENT_READABLE,
+                    uevent_readable, NULL);
+        } else {
+            wavy_log(LOG_ERROR, "Failed to open uevent socket");
+        }
+    }
+}
+
+static void close_source(int *fd, struct wlc_event_source **src) {
+    if (*src) {
+        wlc_event_source_remove(*src);
+        *src = NULL;
+    }
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+void free_sources() {
+    close_source(&route_fd, &route_src);
+    close_source(&uevent_fd, &uevent_src);
+    close_source(&inotify_fd, &inotify_src);
+    if (file_watches) {
+        vector_foreach(file_watches, free);
+        vector_free(file_watches);
+        file_watches = NULL;
+    }
+}
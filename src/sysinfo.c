@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/statvfs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sysinfo.h"
+#include "vector.h"
+
+// at most this many descriptors are kept open, other files are opened for
+// every read
+#define SYSINFO_CACHE_MAX 64
+
+struct cached_fd_t {
+    char *path;
+    int fd;
+    uint32_t users; // reads in progress, the last one closes a dropped fd
+    bool dropped;   // removed from the cache
+};
+
+// *cached_fd_t's, protected by cache_lock
+static struct vector_t *fd_cache = NULL;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// datagram socket used for interface ioctls, created on first use
+static int ioctl_sock = -1;
+
+// only kernel files are cached, their content is generated on every read and
+// they aren't replaced by renames like regular files
+static bool cacheable(const char *path) {
+    return !strncmp(path, "/sys/", 5) || !strncmp(path, "/proc/", 6);
+}
+
+// returns the cached descriptor of a file with a reference held, opening it
+// if necessary. NULL if the file isn't cached or can't be opened.
+static struct cached_fd_t *acquire_fd(const char *path) {
+    struct cached_fd_t *c = NULL;
+
+    pthread_mutex_lock(&cache_lock);
+    if (!fd_cache) {
+        fd_cache = vector_init();
+    }
+    for (uint32_t i = 0; i < fd_cache->length; i++) {
+        struct cached_fd_t *c_i = fd_cache->items[i];
+        if (!strcmp(c_i->path, path)) {
+            c = c_i;
+            break;
+        }
+    }
+
+    if (!c && cacheable(path) && fd_cache->length < SYSINFO_CACHE_MAX) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0 && (c = calloc(1, sizeof(struct cached_fd_t)))) {
+            c->path = strdup(path);
+            c->fd = fd;
+            vector_add(fd_cache, c);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (c) {
+        c->users++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return c;
+}
+
+// must be called with cache_lock held
+static void close_fd(struct cached_fd_t *c) {
+    close(c->fd);
+    free(c->path);
+    free(c);
+}
+
+// stale: the file is gone, drop it so the next read opens it again
+static void release_fd(struct cached_fd_t *c, bool stale) {
+    pthread_mutex_lock(&cache_lock);
+    if (stale && !c->dropped) {
+        for (uint32_t i = 0; i < fd_cache->length; i++) {
+            if (fd_cache->items[i] == c) {
+                vector_del(fd_cache, i);
+                break;
+            }
+        }
+        c->dropped = true;
+    }
+    if (--c->users == 0 && c->dropped) {
+        close_fd(c);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static ssize_t finish_read(char *buf, ssize_t len) {
+    if (len < 0) {
+        return -1;
+    }
+    if (len > 0 && buf[len - 1] == '\n') {
+        len--;
+    }
+    buf[len] = 0;
+    return len;
+}
+
+ssize_t sysinfo_read(const char *path, char *buf, size_t size) {
+    if (size == 0) {
+        return -1;
+    }
+
+    struct cached_fd_t *c = acquire_fd(path);
+    if (c) {
+        ssize_t len = pread(c->fd, buf, size - 1, 0);
+
+        // the device was removed or the file replaced, the descriptor
+        // refers to the old one
+        bool stale = len < 0 &&
+            (errno == ENOENT || errno == ESTALE || errno == ENODEV);
+        release_fd(c, stale);
+        if (!stale) {
+            return finish_read(buf, len);
+        }
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t len = pread(fd, buf, size - 1, 0);
+    close(fd);
+    return finish_read(buf, len);
+}
+
+bool sysinfo_read_int(const char *path, int64_t *val) {
+    char buf[32];
+    if (sysinfo_read(path, buf, sizeof(buf)) <= 0) {
+        return false;
+    }
+
+    char *end;
+    *val = strtoll(buf, &end, 10);
+    return end != buf;
+}
+
+bool sysinfo_meminfo(const char *key, int64_t *kb) {
+    char buf[4096];
+    if (sysinfo_read("/proc/meminfo", buf, sizeof(buf)) <= 0) {
+        return false;
+    }
+
+    // lines look like "MemTotal:       16307064 kB"
+    size_t key_len = strlen(key);
+    for (char *line = buf; line; line = strchr(line, '\n')) {
+        if (*line == '\n') {
+            line++;
+        }
+        if (!strncmp(line, key, key_len) && line[key_len] == ':') {
+            *kb = strtoll(line + key_len + 1, NULL, 10);
+            return true;
+        }
+    }
+    return false;
+}
+
+int32_t sysinfo_fs_used_percent(const char *path) {
+    struct statvfs st;
+    if (statvfs(path, &st) < 0) {
+        return -1;
+    }
+
+    // same calculation as df: blocks reserved for root don't count
+    uint64_t used = st.f_blocks - st.f_bfree;
+    uint64_t total = used + st.f_bavail;
+    if (total == 0) {
+        return 0;
+    }
+    return (used * 100 + total - 1) / total;
+}
+
+bool sysinfo_ipv4_address(const char *dev, char *buf, size_t size) {
+    int sock = __atomic_load_n(&ioctl_sock, __ATOMIC_ACQUIRE);
+    if (sock < 0) {
+        int new_sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (new_sock < 0) {
+            return false;
+        }
+        // another thread might have been faster
+        int expected = -1;
+        if (__atomic_compare_exchange_n(&ioctl_sock, &expected, new_sock,
+                false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            sock = new_sock;
+        } else {
+            close(new_sock);
+            sock = expected;
+        }
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_addr.sa_family = AF_INET;
+    strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+    if (ioctl(sock, SIOCGIFADDR, &ifr) < 0) {
+        return false;
+    }
+
+    struct sockaddr_in *addr = (struct sockaddr_in *) &ifr.ifr_addr;
+    return inet_ntop(AF_INET, &addr->sin_addr, buf, size) != NULL;
+}
+
+void free_sysinfo() {
+    pthread_mutex_lock(&cache_lock);
+    if (fd_cache) {
+        for (uint32_t i = 0; i < fd_cache->length; i++) {
+            struct cached_fd_t *c = fd_cache->items[i];
+            if (c->users) {
+                c->dropped = true; // closed by the last reader
+            } else {
+                close_fd(c);
+            }
+        }
+        vector_free(fd_cache);
+        fd_cache = NULL;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (ioctl_sock >= 0) {
+        close(ioctl_sock);
+        ioctl_sock = -1;
+    }
+}
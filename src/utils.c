@@ -1,14 +1,14 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <time.h>
 #include <cairo/cairo.h>
-#include <lua.h>
-#include <lauxlib.h>
-#include <lualib.h>
 #include <wlc/wlc.h>
 
+#include "luacompat.h"
 #include "bar.h"
 #include "utils.h"
 #include "log.h"
@@ -49,10 +49,14 @@ enum hook_t hook_str_to_enum(const char *str) {
         hook = HOOK_PERIODIC_FAST;
     } else if (!strcmp(str, "hook_periodic_slow")) {
         hook = HOOK_PERIODIC_SLOW;
+    } else if (!strcmp(str, "hook_periodic")) {
+        hook = HOOK_PERIODIC;
     } else if (!strcmp(str, "hook_view_update")) {
         hook = HOOK_VIEW_UPDATE;
     } else if (!strcmp(str, "hook_user")) {
         hook = HOOK_USER;
+    } else if (!strcmp(str, "hook_event")) {
+        hook = HOOK_EVENT;
     } else {
         hook = HOOK_UNKNOWN;
     }
@@ -116,6 +120,44 @@ void cmd_exec(const char *bin, char *const *args) {
     free(cmd);
 }
 
+int64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// function to be called when an error in lua_pcall occurs
+int traceback_msghandler(lua_State *L) {
+    const char *msg = lua_tostring(L, -1);
+    if (!msg) {
+        return 1;
+    }
+    luaL_traceback(L, L, msg, 1);
+    const char *trace = lua_tostring(L, -1);
+    lua_writestringerror("%s\n", trace);
+    return 1;
+}
+
+int spawn_read_blocking(lua_State *L, const char *cmd) {
+    FILE *f = popen(cmd, "r");
+    if (!f) {
+        lua_pushstring(L, "");
+        return 1;
+    }
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    size_t n;
+    do {
+        char *p = luaL_prepbuffer(&b);
+        n = fread(p, 1, LUAL_BUFFERSIZE, f);
+        luaL_addsize(&b, n);
+    } while (n > 0);
+    pclose(f);
+    luaL_pushresult(&b);
+    return 1;
+}
+
 // internal recursive function that prints the frame tree
 static void _print_frame_tree(struct frame *fr, int indent) {
     if (fr) {
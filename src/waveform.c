@@ -1,40 +1,166 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <lua.h>
-#include <lauxlib.h>
-#include <lualib.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/utsname.h>
+#include <sys/statvfs.h>
+#include <netinet/in.h>
 #include <xkbcommon/xkbcommon.h>
 
+#include "luacompat.h"
 #include "commands.h"
 #include "bar.h"
 #include "log.h"
 #include "utils.h"
 #include "layout.h"
+#include "sysinfo.h"
+#include "async.h"
+#include "profiler.h"
+#include "luamem.h"
+#include "snapshot.h"
+#include "loop.h"
+#include "events.h"
+
+// wavy-barhost builds this file into its own binary, where only the
+// functions that don't touch the compositor's state are available
+#ifndef WAVY_BARHOST
+// optional arg: output handle. defaults to the active output. the layout is
+// read from the current snapshot, widgets run on the worker threads.
+static struct snap_frame_t *frame_arg(lua_State *L, struct snapshot_t *s) {
+    return snapshot_output_frame(s, lua_isinteger(L, 1) ?
+            (wlc_handle) lua_tointeger(L, 1) : 0);
+}
 
 static int get_tiling_symbol(lua_State *L) {
-    struct frame *fr = get_active_frame();
-    if (fr) {
-        char *str = config->tile_layout_strs[fr->tile];
-        lua_pushstring(L, str);
-        return 1;
+    struct snapshot_t *s = snapshot_acquire();
+    struct snap_frame_t *fr = s ? frame_arg(L, s) : NULL;
+    lua_pushstring(L, fr && fr->symbol ? fr->symbol : "");
+    if (s) {
+        snapshot_release(s);
     }
-    lua_pushstring(L, "");
     return 1;
 }
 
 static int get_view_title(lua_State *L) {
-    wlc_handle v = get_active_view();
-    if (v) {
-        const char *str = wlc_view_get_title(v);
-        lua_pushstring(L, str);
-        return 1;
+    struct snapshot_t *s = snapshot_acquire();
+    struct snap_frame_t *fr = s ? frame_arg(L, s) : NULL;
+    if (fr && fr->active_view >= 0) {
+        struct snap_view_t *v = s->views->items[fr->active_view];
+        lua_pushstring(L, v->title);
+    } else {
+        lua_pushstring(L, "");
+    }
+    if (s) {
+        snapshot_release(s);
     }
-    lua_pushstring(L, "");
     return 1;
 }
 
+/*
+ * Layout operations for lua keybindings. They change the compositor's state,
+ * so they can only be called on the main loop.
+ */
+
+static const char *const dir_names[] = {"up", "down", "left", "right", NULL};
+
+static void check_layout_access(lua_State *L) {
+    if (!loop_is_main()) {
+        luaL_error(L, "The layout can only be changed by keybindings");
+    }
+}
+
+static enum direction_t check_dir(lua_State *L, int arg) {
+    return luaL_checkoption(L, arg, NULL, dir_names);
+}
+
+// arg: workspace number, starting at 1. returns the index.
+static uint32_t check_workspace(lua_State *L, int arg) {
+    lua_Integer num = luaL_checkinteger(L, arg);
+    if (num < 1 || num > get_workspaces()->length) {
+        luaL_error(L, "Invalid workspace number %d", (int) num);
+    }
+    return num - 1;
+}
+
+// arg: function. the layout operations it calls are redrawn once when it
+// returns, see layout_batch_begin. it can't wait for commands.
+static int layout_batch_lua(lua_State *L) {
+    check_layout_access(L);
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    lua_settop(L, 1);
+    layout_batch_begin();
+    int status = lua_pcall(L, 0, 0, 0);
+    layout_batch_end();
+    if (status != LUA_OK) {
+        return lua_error(L);
+    }
+    return 0;
+}
+
+// arg: "right" (new frame next to the active one) or "down" (below it),
+// like the 'new_frame' keybinding
+static int layout_frame_add(lua_State *L) {
+    check_layout_access(L);
+    static const char *const sides[] = {"right", "down", NULL};
+    frame_add(luaL_checkoption(L, 1, NULL, sides) ? DIR_DOWN : DIR_RIGHT);
+    return 0;
+}
+
+static int layout_frame_delete(lua_State *L) {
+    check_layout_access(L);
+    frame_delete();
+    return 0;
+}
+
+// arg: direction or the handle of a view
+static int layout_focus(lua_State *L) {
+    check_layout_access(L);
+    if (lua_isinteger(L, 1)) {
+        focus_view(lua_tointeger(L, 1));
+    } else {
+        focus_direction(check_dir(L, 1));
+    }
+    return 0;
+}
+
+// arg: direction. moves the active view.
+static int layout_move(lua_State *L) {
+    check_layout_access(L);
+    move_direction(check_dir(L, 1));
+    return 0;
+}
+
+// args: direction, percentage
+static int layout_resize(lua_State *L) {
+    check_layout_access(L);
+    enum direction_t dir = check_dir(L, 1);
+    frame_resize_percent(dir, luaL_checknumber(L, 2));
+    return 0;
+}
+
+// arg: workspace number. moves the active view.
+static int layout_move_to_workspace(lua_State *L) {
+    check_layout_access(L);
+    move_to_workspace(check_workspace(L, 1));
+    return 0;
+}
+
+// arg: workspace number
+static int layout_select_workspace(lua_State *L) {
+    check_layout_access(L);
+    workspace_switch_to(check_workspace(L, 1));
+    return 0;
+}
+
+static int layout_cycle_tiling_mode(lua_State *L) {
+    check_layout_access(L);
+    cycle_tiling_mode();
+    return 0;
+}
+
 static int trigger_hook_lua(lua_State *L) {
     if (lua_type(L, -1)) {
         enum hook_t h = hook_str_to_enum(lua_tostring(L, -1));
@@ -44,11 +170,287 @@ static int trigger_hook_lua(lua_State *L) {
     }
     return 1;
 }
+#endif
+
+/*
+ * Native widget backends. These read sysfs/procfs through the sysinfo fd cache
+ * instead of forking helper programs and return the widget text, or nil if
+ * there is nothing to show.
+ */
+
+// arg: battery name (BAT0, BAT1, ...)
+static int native_battery(lua_State *L) {
+    const char *bat = luaL_checkstring(L, 1);
+    char path[256];
+    int64_t cap;
+
+    snprintf(path, sizeof(path), "/sys/class/power_supply/%s/capacity", bat);
+    if (!sysinfo_read_int(path, &cap)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushfstring(L, "%s: %d%%", bat, (int) cap);
+    return 1;
+}
+
+// returns the name of the first backlight device, or nil
+static int native_backlight_device(lua_State *L) {
+    DIR *dir = opendir("/sys/class/backlight");
+    if (!dir) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    struct dirent *d;
+    while ((d = readdir(dir))) {
+        if (d->d_name[0] != '.') {
+            lua_pushstring(L, d->d_name);
+            closedir(dir);
+            return 1;
+        }
+    }
+    closedir(dir);
+    lua_pushnil(L);
+    return 1;
+}
+
+// arg: backlight device (intel_backlight, acpi_video0, ...)
+static int native_brightness(lua_State *L) {
+    const char *dev = luaL_checkstring(L, 1);
+    char path[256];
+    int64_t cur, max;
+
+    snprintf(path, sizeof(path), "/sys/class/backlight/%s/brightness", dev);
+    bool ok = sysinfo_read_int(path, &cur);
+    snprintf(path, sizeof(path), "/sys/class/backlight/%s/max_brightness",
+            dev);
+    if (!ok || !sysinfo_read_int(path, &max) || max <= 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    int pct = lround(100.0 * cur / max);
+    lua_pushfstring(L, "Screen: %d%%", pct);
+    return 1;
+}
+
+// arg: directory on the file system
+static int native_fs_status(lua_State *L) {
+    const char *dir = luaL_checkstring(L, 1);
+    int32_t used = sysinfo_fs_used_percent(dir);
+    if (used < 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    // df pads the percentage to the width of its "Use%" header
+    char buf[512];
+    snprintf(buf, sizeof(buf), "Disk: %s%3d%% used", dir, used);
+    lua_pushstring(L, buf);
+    return 1;
+}
+
+// arg: network device
+static int native_net_device(lua_State *L) {
+    const char *dev = luaL_checkstring(L, 1);
+    char ip[INET_ADDRSTRLEN];
+    if (!sysinfo_ipv4_address(dev, ip, sizeof(ip))) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushfstring(L, "%s: %s", dev, ip);
+    return 1;
+}
+
+static int native_kernel(lua_State *L) {
+    struct utsname u;
+    if (uname(&u) < 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushfstring(L, "Linux: %s", u.release);
+    return 1;
+}
+
+/*
+ * File primitives for widgets. Descriptors are cached, reading a file costs a
+ * single pread. Meant for small files like sysfs attributes, the content is
+ * truncated to 4 KiB.
+ */
+
+// arg: path. returns the content without the trailing newline, or nil
+static int sys_read_file(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+    char buf[4096];
+    ssize_t len = sysinfo_read(path, buf, sizeof(buf));
+    if (len < 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushlstring(L, buf, len);
+    return 1;
+}
+
+// arg: path. returns the integer the file contains, or nil
+static int sys_read_int(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+    int64_t val;
+    if (!sysinfo_read_int(path, &val)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushinteger(L, val);
+    return 1;
+}
+
+// arg: path. returns {size, free, avail, used_percent} of the file system
+// containing path (sizes in bytes), or nil
+static int sys_statvfs(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+    struct statvfs st;
+    if (statvfs(path, &st) < 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, (lua_Integer) st.f_blocks * st.f_frsize);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, (lua_Integer) st.f_bfree * st.f_frsize);
+    lua_setfield(L, -2, "free");
+    lua_pushinteger(L, (lua_Integer) st.f_bavail * st.f_frsize);
+    lua_setfield(L, -2, "avail");
+    lua_pushinteger(L, sysinfo_fs_used_percent(path));
+    lua_setfield(L, -2, "used_percent");
+    return 1;
+}
+
+// arg: key in /proc/meminfo (MemTotal, MemAvailable, ...). returns the value
+// in kB, or nil
+static int sys_meminfo(lua_State *L) {
+    const char *key = luaL_checkstring(L, 1);
+    int64_t kb;
+    if (!sysinfo_meminfo(key, &kb)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushinteger(L, kb);
+    return 1;
+}
+
+#ifndef WAVY_BARHOST
+// arg: hook name. returns how often the hook was requested and how often it
+// actually ran (coalesced hooks only, see hook_request)
+static int hook_stats_lua(lua_State *L) {
+    enum hook_t h = hook_str_to_enum(luaL_checkstring(L, 1));
+    if (h == HOOK_UNKNOWN) {
+        return luaL_error(L, "Invalid hook type");
+    }
+    uint64_t requested, executed;
+    hook_stats(h, &requested, &executed);
+    lua_pushinteger(L, requested);
+    lua_pushinteger(L, executed);
+    return 2;
+}
+
+// arg: boolean, turns the profiler of lua callbacks on or off
+static int profiler_lua(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TBOOLEAN);
+    profiler_set_enabled(lua_toboolean(L, 1));
+    return 0;
+}
+
+// returns the memory used by lua per subsystem: a table with 'in_use',
+// 'allocated' (bytes) and 'emergency_gcs' for each of them
+static int lua_memory(lua_State *L) {
+    lua_createtable(L, 0, LUAMEM_SUBSYSTEMS);
+    for (uint32_t i = 0; i < LUAMEM_SUBSYSTEMS; i++) {
+        struct luamem_stats_t stats;
+        luamem_stats(i, &stats);
+        lua_createtable(L, 0, 3);
+        lua_pushinteger(L, stats.in_use);
+        lua_setfield(L, -2, "in_use");
+        lua_pushinteger(L, stats.allocated);
+        lua_setfield(L, -2, "allocated");
+        lua_pushinteger(L, stats.emergency_gcs);
+        lua_setfield(L, -2, "emergency_gcs");
+        lua_setfield(L, -2, luamem_subsys_str(i));
+    }
+    return 1;
+}
+
+// reloads the config file, see config_reload
+static int reload_lua(lua_State *L) {
+    (void) L;
+    config_reload();
+    return 0;
+}
+
+// returns the profiler report as a string
+static int profiler_report_lua(lua_State *L) {
+    char *report = profiler_report();
+    lua_pushstring(L, report ? report : "");
+    free(report);
+    return 1;
+}
+#else
+// the bar host runs the config for its widgets, the subscribers are called
+// by the compositor
+static int on_event_ignored(lua_State *L) {
+    (void) L;
+    return 0;
+}
+#endif
 
 int luaopen_libwaveform(lua_State *L) {
+#ifndef WAVY_BARHOST
     // statusbar related functions
     lua_register(L, "get_tiling_symbol", get_tiling_symbol);
     lua_register(L, "get_view_title", get_view_title);
+    lua_register(L, "get_layout", snapshot_get_layout);
+
+    // layout operations, main loop only
+    lua_register(L, "layout_batch", layout_batch_lua);
+    lua_register(L, "layout_frame_add", layout_frame_add);
+    lua_register(L, "layout_frame_delete", layout_frame_delete);
+    lua_register(L, "layout_focus", layout_focus);
+    lua_register(L, "layout_move", layout_move);
+    lua_register(L, "layout_resize", layout_resize);
+    lua_register(L, "layout_move_to_workspace", layout_move_to_workspace);
+    lua_register(L, "layout_select_workspace", layout_select_workspace);
+    lua_register(L, "layout_cycle_tiling_mode", layout_cycle_tiling_mode);
     lua_register(L, "trigger_hook", trigger_hook_lua);
+    lua_register(L, "hook_stats", hook_stats_lua);
+
+    // profiler of lua callbacks
+    lua_register(L, "profiler", profiler_lua);
+    lua_register(L, "profiler_report", profiler_report_lua);
+    lua_register(L, "lua_memory", lua_memory);
+
+    lua_register(L, "reload", reload_lua);
+
+    // compositor events, see events.h
+    lua_register(L, "on_event", events_subscribe);
+#else
+    lua_register(L, "on_event", on_event_ignored);
+#endif
+
+    // runs a shell command and returns its output. yields inside widget
+    // callbacks and lua keybindings instead of blocking.
+    lua_register(L, "spawn_read", async_spawn_read);
+
+    // native widget backends
+    lua_register(L, "native_battery", native_battery);
+    lua_register(L, "native_backlight_device", native_backlight_device);
+    lua_register(L, "native_brightness", native_brightness);
+    lua_register(L, "native_fs_status", native_fs_status);
+    lua_register(L, "native_net_device", native_net_device);
+    lua_register(L, "native_kernel", native_kernel);
+
+    // file primitives
+    lua_register(L, "sys_read_file", sys_read_file);
+    lua_register(L, "sys_read_int", sys_read_int);
+    lua_register(L, "sys_statvfs", sys_statvfs);
+    lua_register(L, "sys_meminfo", sys_meminfo);
     return 0;
 }
@@ -12,6 +12,16 @@
 #include "bar.h"
 #include "extensions.h"
 #include "wallpaper.h"
+#include "loop.h"
+#include "scheduler.h"
+#include "sources.h"
+#include "workers.h"
+#include "sysinfo.h"
+#include "async.h"
+#include "barhost.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "events.h"
 
 #define WAVY_VERSION "wavy version: 0.0.1"
 
@@ -30,9 +40,10 @@ int main(int argc, char **argv) {
         "  -W           --no-wlc-output     Disable output from wlc\n"
         "  -C           --no-color          Disable colored log output\n"
         "  -c <file>    --config <file>     Select a config file\n"
+        "  -p           --profile           Profile lua callbacks\n"
         "\n";
 
-    const char *optstring = "hvdWCc:";
+    const char *optstring = "hvdWCc:p";
     const struct option long_options[] = {
         {"help",            no_argument,        NULL, 'h'},
         {"version",         no_argument,        NULL, 'v'},
@@ -40,6 +51,7 @@ int main(int argc, char **argv) {
         {"no-wlc-output",   no_argument,        NULL, 'W'},
         {"no-color",        no_argument,        NULL, 'C'},
         {"config",          required_argument,  NULL, 'c'},
+        {"profile",         no_argument,        NULL, 'p'},
         {0, 0, 0, 0}
     };
 
@@ -72,6 +84,9 @@ int main(int argc, char **argv) {
         case 'c':
             cmdline_config_file = optarg;
             break;
+        case 'p':
+            profiler_set_enabled(true);
+            break;
         default:
             fprintf(stderr, "%s", usage);
             exit(EXIT_FAILURE);
@@ -84,21 +99,41 @@ int main(int argc, char **argv) {
     set_wlc_callbacks();
     init_layout();
     init_bar_threads();
+    init_workers();
 
     if (!wlc_init()) {
         exit(EXIT_FAILURE);
     }
 
+    // lets other threads hand work over to the main loop
+    init_loop();
+    init_profiler();
+    init_barhost();
+    init_scheduler();
+    init_sources();
+
     // wayland protocol extensions
     register_extensions();
 
     wlc_run();
 
+    free_async();
+    free_sources();
+    free_scheduler();
+    free_callbacks();
+    free_barhost();
+    stop_workers();
     stop_bar_threads();
     free_commands();
     free_config();
+    free_events();
+    free_snapshot();
     free_all_outputs();
     free_workspaces();
+    free_bar_config();
+    free_loop();
+    free_sysinfo();
+    free_profiler();
 
     exit(EXIT_SUCCESS);
 }
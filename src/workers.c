@@ -0,0 +1,434 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "luacompat.h"
+#include "workers.h"
+#include "async.h"
+#include "budget.h"
+#include "profiler.h"
+#include "luamem.h"
+#include "barhost.h"
+#include "scheduler.h"
+#include "bar.h"
+#include "config.h"
+#include "log.h"
+#include "utils.h"
+#include "vector.h"
+
+struct widget_resume_t {
+    lua_State *co;
+    char *output;
+};
+
+struct worker_t {
+    pthread_t thread;
+    lua_State *L;
+
+    // *status_entry_t's waiting to be run and *widget_resume_t's of
+    // coroutines whose command finished, protected by lock
+    struct vector_t *queue;
+    struct vector_t *resumes;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool quit;
+};
+
+static struct worker_t *workers = NULL;
+static uint32_t num_workers = 0;
+
+// looks up the callbacks of the widgets pinned to this worker in its own
+// lua_State and registers them there
+static void resolve_widgets(struct worker_t *w, uint32_t idx) {
+    lua_State *L = w->L;
+    struct vector_t *widgets = get_widgets();
+
+    if (lua_getglobal(L, "bar") != LUA_TTABLE ||
+        lua_getfield(L, -1, "widgets") != LUA_TTABLE) {
+        lua_settop(L, 0);
+        return;
+    }
+
+    for (uint32_t i = 0; i < widgets->length; i++) {
+        struct status_entry_t *e = widgets->items[i];
+        if (e->worker != idx) {
+            continue;
+        }
+        if (lua_geti(L, -1, e->config_idx) == LUA_TTABLE) {
+            if (lua_geti(L, -1, 3) == LUA_TFUNCTION) {
+                e->worker_ref = luaL_ref(L, LUA_REGISTRYINDEX); // pops stack
+            } else {
+                lua_pop(L, 1);
+            }
+            if (e->precompute &&
+                lua_getfield(L, -1, "next") == LUA_TFUNCTION) {
+                e->worker_next_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+            } else if (e->precompute) {
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 1);
+    }
+    lua_settop(L, 0);
+}
+
+// stores the result of a finished widget coroutine. returns true if the
+// displayed content changed.
+static bool widget_result(struct status_entry_t *e, lua_State *co) {
+    bool changed = false;
+
+    if (!lua_istable(co, -1)) {
+        wavy_log(LOG_ERROR,
+                "Statusbar callback function returned a %s instead of a table",
+                luaL_typename(co, -1));
+    } else if (lua_geti(co, -1, 1) == LUA_TNUMBER &&
+               lua_geti(co, -2, 2) == LUA_TNUMBER &&
+               lua_geti(co, -3, 3) == LUA_TSTRING) {
+
+        changed = set_widget_content(e, e->run_output, lua_tostring(co, -1),
+                lua_tointeger(co, -2), lua_tointeger(co, -3));
+
+        // per-output widgets only affect the bar of their output
+        if (changed && e->run_output) {
+            bar_request_repaint_output(e->run_output);
+            changed = false;
+        }
+    } else {
+        wavy_log(LOG_ERROR,
+                "Invalid entry in table returned by a statusbar callback");
+    }
+
+    lua_settop(co, 0);
+    return changed;
+}
+
+static bool run_widget(struct worker_t *w, struct status_entry_t *e);
+
+static void budget_name(struct status_entry_t *e, char *buf, size_t size) {
+    snprintf(buf, size, "Widget %u", e->config_idx);
+}
+
+static void profile_widget(struct worker_t *w, struct status_entry_t *e) {
+    if (!e->budget.profile && profiler_enabled()) {
+        e->budget.profile = profiler_get("widget", e->lua_reg_idx, w->L,
+                e->worker_ref);
+    }
+}
+
+// resumes a widget coroutine under the budget of the widget
+static int resume_budgeted(struct worker_t *w, struct status_entry_t *e,
+        lua_State *co, int nargs) {
+
+    char name[32];
+    budget_name(e, name, sizeof(name));
+    profile_widget(w, e);
+    budget_start(co, &e->budget);
+    int status = async_resume(co, nargs);
+    budget_end(co, name);
+    luamem_collect(co);
+    return status;
+}
+
+// asks a widget for its content on the next tick, so the bar can draw it
+// ahead of time. it runs outside of a coroutine, spawn_read blocks here.
+static void run_next(struct worker_t *w, struct status_entry_t *e) {
+    lua_State *L = w->L;
+    if (!budget_enabled(&e->budget)) {
+        return;
+    }
+
+    char name[32];
+    budget_name(e, name, sizeof(name));
+    lua_pushcfunction(L, traceback_msghandler);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, e->worker_next_ref);
+    lua_pushinteger(L, scheduler_next_tick(e) / 1000);
+    profile_widget(w, e);
+    budget_start(L, &e->budget);
+    int status = lua_pcall(L, 1, 1, 1);
+    budget_end(L, name);
+    luamem_collect(L);
+    if (status != LUA_OK) {
+        wavy_log(LOG_ERROR, "Error in statusbar 'next' function");
+    } else if (lua_istable(L, -1) &&
+               lua_geti(L, -1, 1) == LUA_TNUMBER &&
+               lua_geti(L, -2, 2) == LUA_TNUMBER &&
+               lua_geti(L, -3, 3) == LUA_TSTRING) {
+
+        stage_widget_content(e, lua_tostring(L, -1), lua_tointeger(L, -2),
+                lua_tointeger(L, -3));
+    } else {
+        wavy_log(LOG_ERROR, "Invalid table returned by a 'next' function");
+    }
+    lua_settop(L, 0);
+}
+
+// handles the status of a widget coroutine after it was resumed. returns
+// true if the displayed content changed.
+static bool widget_step(struct worker_t *w, struct status_entry_t *e,
+        lua_State *co, int status) {
+
+    if (status == LUA_YIELD) {
+        e->co = co; // waiting for a command, resumed by the main loop
+        return false;
+    }
+
+    bool changed = false;
+    if (status == LUA_OK) {
+        changed = widget_result(e, co);
+        if (e->worker_next_ref != LUA_NOREF) {
+            run_next(w, e);
+        }
+    } else {
+        wavy_log(LOG_ERROR, "Error in statusbar callback function");
+    }
+    async_thread_free(w->L, co);
+    e->co = NULL;
+
+    // per-output widgets go on with the next output that needs a run
+    if (e->rerun || e->scope == SCOPE_OUTPUT) {
+        e->rerun = false;
+        changed |= run_widget(w, e);
+    }
+    return changed;
+}
+
+// calls the lua callback of a widget in a coroutine and stores its result.
+// returns true if the displayed content changed.
+static bool run_widget(struct worker_t *w, struct status_entry_t *e) {
+    if (e->worker_ref == LUA_NOREF || !budget_enabled(&e->budget)) {
+        return false;
+    }
+
+    // still waiting for the previous run, start over when it's done
+    if (e->co) {
+        e->rerun = true;
+        return false;
+    }
+
+    // per-output widgets run once per output that needs an update, the
+    // output is passed to the callback
+    wlc_handle output = 0;
+    if (e->scope == SCOPE_OUTPUT && !widget_take_dirty(e, &output)) {
+        return false;
+    }
+
+    lua_rawgeti(w->L, LUA_REGISTRYINDEX, e->worker_ref);
+    lua_State *co = async_thread_new(w->L);
+    e->run_output = output;
+
+    int nargs = 0;
+    if (output) {
+        lua_pushinteger(co, output);
+        nargs = 1;
+    }
+    return widget_step(w, e, co, resume_budgeted(w, e, co, nargs));
+}
+
+// resumes the coroutine of a widget with the output of its command
+static bool resume_widget(struct worker_t *w, struct widget_resume_t *r) {
+    struct vector_t *widgets = get_widgets();
+    for (uint32_t i = 0; i < widgets->length; i++) {
+        struct status_entry_t *e = widgets->items[i];
+        if (e->co == r->co) {
+            lua_pushstring(r->co, r->output);
+            return widget_step(w, e, r->co, resume_budgeted(w, e, r->co, 1));
+        }
+    }
+    return false;
+}
+
+// called on the main loop, hands the output over to the worker thread
+static void widget_resume(void *owner, lua_State *co, char *output) {
+    struct worker_t *w = owner;
+    struct widget_resume_t *r = malloc(sizeof(struct widget_resume_t));
+    if (!r) {
+        wavy_log(LOG_ERROR, "Failed to allocate widget resume");
+        free(output);
+        return;
+    }
+    r->co = co;
+    r->output = output ? output : strdup("");
+
+    pthread_mutex_lock(&w->lock);
+    vector_add(w->resumes, r);
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void *worker_func(void *arg) {
+    struct worker_t *w = arg;
+    uint32_t idx = w - workers;
+
+    // loading the config can take a while, do it here instead of blocking
+    // the startup. queued widgets wait until this is done.
+    w->L = load_config_state(config->file, LUAMEM_WIDGETS);
+    if (w->L) {
+        resolve_widgets(w, idx);
+        async_set_runner(w->L, widget_resume, w);
+    } else {
+        wavy_log(LOG_ERROR, "Widget worker %u failed to load the config", idx);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->quit) {
+        if (w->queue->length == 0 && w->resumes->length == 0) {
+            pthread_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+
+        // take everything that is queued, widgets that were queued together
+        // cause a single repaint
+        struct vector_t *batch = w->queue;
+        struct vector_t *resumes = w->resumes;
+        w->queue = vector_init();
+        w->resumes = vector_init();
+        for (uint32_t i = 0; i < batch->length; i++) {
+            struct status_entry_t *e = batch->items[i];
+            e->queued = false;
+        }
+        pthread_mutex_unlock(&w->lock);
+
+        bool changed = false;
+        for (uint32_t i = 0; i < resumes->length; i++) {
+            struct widget_resume_t *r = resumes->items[i];
+            if (w->L) {
+                changed |= resume_widget(w, r);
+            }
+            free(r->output);
+            free(r);
+        }
+        for (uint32_t i = 0; w->L && i < batch->length; i++) {
+            changed |= run_widget(w, batch->items[i]);
+        }
+        vector_free(resumes);
+        vector_free(batch);
+
+        // nothing to repaint if every widget returned the same content
+        if (changed) {
+            bar_request_repaint_all();
+        }
+
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (w->L) {
+        luamem_close(w->L);
+        w->L = NULL;
+    }
+    return NULL;
+}
+
+void queue_widgets_output(struct status_entry_t **entries, uint32_t count,
+        wlc_handle output) {
+
+    if (count == 0) {
+        return;
+    }
+    for (uint32_t j = 0; j < count; j++) {
+        if (entries[j]->scope == SCOPE_OUTPUT) {
+            widget_mark_dirty(entries[j], output);
+        }
+    }
+
+    // global widgets go to the bar host if it runs them
+    bool hosted[count];
+    for (uint32_t j = 0; j < count; j++) {
+        hosted[j] = barhost_queue(entries[j]);
+    }
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+        struct worker_t *w = &workers[i];
+        bool added = false;
+
+        pthread_mutex_lock(&w->lock);
+        for (uint32_t j = 0; j < count; j++) {
+            struct status_entry_t *e = entries[j];
+            if (e->worker == i && !e->queued && !hosted[j]) {
+                e->queued = true;
+                vector_add(w->queue, e);
+                added = true;
+            }
+        }
+        if (added) {
+            pthread_cond_signal(&w->cond);
+        }
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+void queue_widgets(struct status_entry_t **entries, uint32_t count) {
+    queue_widgets_output(entries, count, 0);
+}
+
+void init_workers() {
+    struct vector_t *widgets = get_widgets();
+
+    // no need for idle workers
+    num_workers = config->statusbar_workers;
+    if (num_workers > widgets->length) {
+        num_workers = widgets->length;
+    }
+    if (num_workers == 0) {
+        return;
+    }
+
+    workers = calloc(num_workers, sizeof(struct worker_t));
+    if (!workers) {
+        wavy_log(LOG_ERROR, "Failed to allocate widget workers");
+        exit(EXIT_FAILURE);
+    }
+
+    // spread the widgets evenly across the workers
+    for (uint32_t i = 0; i < widgets->length; i++) {
+        struct status_entry_t *e = widgets->items[i];
+        e->worker = i % num_workers;
+        e->worker_ref = LUA_NOREF;
+        e->worker_next_ref = LUA_NOREF;
+    }
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+        struct worker_t *w = &workers[i];
+        w->queue = vector_init();
+        w->resumes = vector_init();
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        pthread_create(&w->thread, NULL, worker_func, w);
+    }
+
+    wavy_log(LOG_DEBUG, "Started %u widget workers", num_workers);
+}
+
+void stop_workers() {
+    for (uint32_t i = 0; i < num_workers; i++) {
+        struct worker_t *w = &workers[i];
+        pthread_mutex_lock(&w->lock);
+        w->quit = true;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+        struct worker_t *w = &workers[i];
+        pthread_join(w->thread, NULL);
+
+        // commands of its coroutines would resume them in a closed state
+        async_drop(w);
+        vector_free(w->queue);
+        for (uint32_t j = 0; j < w->resumes->length; j++) {
+            struct widget_resume_t *r = w->resumes->items[j];
+            free(r->output);
+            free(r);
+        }
+        vector_free(w->resumes);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+    }
+
+    free(workers);
+    workers = NULL;
+    num_workers = 0;
+}